@@ -0,0 +1,58 @@
+#include "ArenaAllocator.h"
+#include <cstdint>
+using namespace std;
+
+ArenaAllocator::ArenaAllocator(size_t chunkSize)
+	: m_chunkSize(chunkSize), m_next(nullptr), m_end(nullptr)
+{
+}
+
+ArenaAllocator::~ArenaAllocator()
+{
+	for (size_t i = 0; i < m_chunks.size(); i++)
+		::operator delete(m_chunks[i].memory);
+}
+
+void* ArenaAllocator::allocate(size_t size, size_t alignment)
+{
+	// Rounds the start of the unused space up to the alignment, starting a new chunk if
+	// the block doesn't fit in what's left
+	uintptr_t next = ((uintptr_t)m_next + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	if (m_next == nullptr || next + size > (uintptr_t)m_end) {
+		addChunk(size + alignment > m_chunkSize ? size + alignment : m_chunkSize);
+		next = ((uintptr_t)m_next + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	}
+	m_next = (char*)(next + size);
+	return (void*)next;
+}
+
+void ArenaAllocator::release()
+{
+	if (m_chunks.empty())
+		return;
+	size_t total = bytesReserved();
+	if (m_chunks.size() > 1) {
+		for (size_t i = 0; i < m_chunks.size(); i++)
+			::operator delete(m_chunks[i].memory);
+		m_chunks.clear();
+		addChunk(total);
+	}
+	m_next = m_chunks[0].memory;
+	m_end = m_next + m_chunks[0].size;
+}
+
+size_t ArenaAllocator::bytesReserved() const
+{
+	size_t total = 0;
+	for (size_t i = 0; i < m_chunks.size(); i++)
+		total += m_chunks[i].size;
+	return total;
+}
+
+void ArenaAllocator::addChunk(size_t size)
+{
+	Chunk chunk = { static_cast<char*>(::operator new(size)), size };
+	m_chunks.push_back(chunk);
+	m_next = chunk.memory;
+	m_end = chunk.memory + size;
+}
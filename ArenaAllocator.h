@@ -0,0 +1,52 @@
+// ArenaAllocator.h
+
+// Memory policies for ExpandableHashMap.  An allocator hands out raw blocks with
+// allocate(size, alignment), takes them back with deallocate(p, size), and gives up
+// everything at once with release(), which the map calls when it's reset or destroyed.
+//
+// HeapAllocator takes every block from the global heap.  ArenaAllocator carves blocks out
+// of large chunks and only frees memory on release(), which suits scratch maps that are
+// filled, used and reset over and over: after the first round they never touch the heap.
+#ifndef ARENAALLOCATOR_H
+#define ARENAALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+class HeapAllocator
+{
+public:
+	void* allocate(size_t size, size_t /* alignment */) { return ::operator new(size); }
+	void deallocate(void* p, size_t /* size */) { ::operator delete(p); }
+	void release() {}
+};
+
+class ArenaAllocator
+{
+public:
+	explicit ArenaAllocator(size_t chunkSize = 64 * 1024);
+	~ArenaAllocator();
+	void* allocate(size_t size, size_t alignment);
+	void deallocate(void* /* p */, size_t /* size */) {} // Memory only comes back on release
+	// Frees everything handed out.  One chunk as large as all of them together is kept, so
+	// the same allocations next time fit without asking the heap for more.
+	void release();
+	size_t bytesReserved() const; // Total size of the chunks held
+
+	ArenaAllocator(const ArenaAllocator&) = delete;
+	ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+private:
+	struct Chunk {
+		char* memory;
+		size_t size;
+	};
+	size_t m_chunkSize; // Smallest chunk to ask the heap for
+	std::vector<Chunk> m_chunks; // The last one is being carved up
+	char* m_next; // Start of the unused part of the last chunk
+	char* m_end;
+
+	void addChunk(size_t size);
+};
+
+#endif
@@ -0,0 +1,1021 @@
+// Microbenchmarks, run with "GooberEats --bench mapdata.txt".  Building with
+// BENCHMARK_COUNT_ALLOCATIONS defined also counts allocations, by replacing the global
+// operator new; that hooks every allocation in the program, so normal builds leave it out
+// and the benchmarks skip the counts.
+//
+// Also stress tests for everything threads share (the concurrent map, a router and its
+// route cache, preprocessing built on first use, parallel planning), run with
+// "GooberEats --stress mapdata.txt".  They check their own answers, but they're meant to
+// run under ThreadSanitizer, which reports any data race they provoke.  Visual C++ has no
+// ThreadSanitizer, so build with GCC or Clang:
+//
+//   g++ -std=c++17 -g -O1 -fsanitize=thread -pthread *.cpp -o GooberEats-tsan
+//   ./GooberEats-tsan --stress mapdata.txt
+//
+// A clean run prints no "WARNING: ThreadSanitizer" reports and exits with status 0.
+#include "provided.h"
+#include "ConcurrentHashMap.h"
+#include "ConnectedComponents.h"
+#include "ContractionHierarchy.h"
+#include "ExpandableHashMap.h"
+#include "GeoDistance.h"
+#include "HashMapStats.h"
+#include "Landmarks.h"
+#include "MapFile.h"
+#include "RouteSearch.h"
+#include "StreetGraph.h"
+#include "support.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+namespace {
+#if defined(BENCHMARK_COUNT_ALLOCATIONS)
+	const bool COUNTING_ALLOCATIONS = true;
+#else
+	const bool COUNTING_ALLOCATIONS = false;
+#endif
+	atomic<long long> g_allocations(0); // Only ever changes if COUNTING_ALLOCATIONS
+
+	double secondsSince(chrono::steady_clock::time_point start)
+	{
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	// Random origin/destination pairs, the same ones every run
+	void randomPairs(const StreetMap& sm, int n, vector<GeoCoord>& starts, vector<GeoCoord>& ends)
+	{
+		mt19937 rng(32);
+		uniform_int_distribution<int> pick(0, sm.nodeCount() - 1);
+		for (int i = 0; i < n; i++) {
+			starts.push_back(sm.getCoord(pick(rng)));
+			ends.push_back(sm.getCoord(pick(rng)));
+		}
+	}
+
+	// Random map points from the largest strong component, so every one can reach every other
+	vector<GeoCoord> stopsInLargestComponent(const StreetMap& sm, int n)
+	{
+		const ConnectedComponents& components = StreetMapInternals::components(sm);
+		vector<int> sizes(components.numStrongComponents(), 0);
+		for (int i = 0; i < sm.nodeCount(); i++)
+			sizes[components.strongComponent(i)]++;
+		uint32_t largest = (uint32_t)(max_element(sizes.begin(), sizes.end()) - sizes.begin());
+		mt19937 rng(32);
+		uniform_int_distribution<int> pick(0, sm.nodeCount() - 1);
+		vector<GeoCoord> stops;
+		while ((int)stops.size() < n) {
+			NodeId i = pick(rng);
+			if (components.strongComponent(i) == largest)
+				stops.push_back(sm.getCoord(i));
+		}
+		return stops;
+	}
+
+	template<typename T>
+	bool sameArray(const T* a, const T* b, size_t n)
+	{
+		return n == 0 || memcmp(a, b, n * sizeof(T)) == 0;
+	}
+
+	// Whether two graphs have the same bytes in every table
+	bool sameGraph(const StreetGraph& a, const StreetGraph& b)
+	{
+		if (a.numNodes != b.numNodes || a.numEdges != b.numEdges || a.numNames != b.numNames || a.numIndexSlots != b.numIndexSlots || a.exactCoords != b.exactCoords)
+			return false;
+		return sameArray(a.coords, b.coords, a.numNodes) && sameArray(a.nodePoints, b.nodePoints, 3 * (size_t)a.numNodes) &&
+			sameArray(a.textOffsets, b.textOffsets, 2 * a.numNodes + 1) && sameArray(a.text, b.text, a.textOffsets[2 * a.numNodes]) &&
+			sameArray(a.edgeOffsets, b.edgeOffsets, a.numNodes + 1) && sameArray(a.edgeTargets, b.edgeTargets, a.numEdges) &&
+			sameArray(a.edgeNames, b.edgeNames, a.numEdges) && sameArray(a.edgeLengths, b.edgeLengths, a.numEdges) &&
+			sameArray(a.edgeBearings, b.edgeBearings, a.numEdges) &&
+			sameArray(a.reverseOffsets, b.reverseOffsets, a.numNodes + 1) && sameArray(a.reverseSources, b.reverseSources, a.numEdges) &&
+			sameArray(a.reverseEdges, b.reverseEdges, a.numEdges) && sameArray(a.nameOffsets, b.nameOffsets, a.numNames + 1) &&
+			sameArray(a.names, b.names, a.nameOffsets[a.numNames]) && sameArray(a.nodeIndex, b.nodeIndex, a.numIndexSlots);
+	}
+
+	// Parses the map text on one thread and then on the thread pool, and checks that both
+	// build exactly the same tables
+	void benchParse(const string& mapFile)
+	{
+		StreetGraphData serial, parallel;
+		auto start = chrono::steady_clock::now();
+		serial.parse(mapFile, false);
+		double serialSeconds = secondsSince(start);
+		start = chrono::steady_clock::now();
+		parallel.parse(mapFile, true);
+		double parallelSeconds = secondsSince(start);
+
+		cout << "Parsing " << mapFile << " (" << sharedThreadPool().numThreads() << " threads)" << endl;
+		cout << "  " << serialSeconds * 1000 << " ms on one thread, " << parallelSeconds * 1000 << " ms in parallel" << endl;
+		if (!sameGraph(serial.view(), parallel.view()))
+			cout << "  MISMATCH: the parallel parse built different tables" << endl;
+	}
+
+	// Scans every point's neighbors the way a route search expands a point
+	void benchNeighborAccess(const StreetMap& sm)
+	{
+		vector<GeoCoord> coords;
+		for (int i = 0; i < sm.nodeCount(); i++)
+			coords.push_back(sm.getCoord(i));
+
+		vector<StreetSegment> segs;
+		long long before = g_allocations;
+		size_t seen = 0;
+		for (size_t i = 0; i < coords.size(); i++) {
+			sm.getSegmentsThatStartWith(coords[i], segs);
+			seen += segs.size();
+		}
+		long long copying = g_allocations - before;
+
+		before = g_allocations;
+		size_t viewed = 0;
+		for (int i = 0; i < sm.nodeCount(); i++)
+			viewed += sm.getEdgesFrom(i).count;
+		long long viewing = g_allocations - before;
+
+		cout << "Neighbor access over " << coords.size() << " points (" << seen << " segments)" << endl;
+		if (COUNTING_ALLOCATIONS) {
+			cout << "  getSegmentsThatStartWith: " << (double)copying / coords.size() << " allocations per expansion" << endl;
+			cout << "  getEdgesFrom:             " << (double)viewing / coords.size() << " allocations per expansion" << endl;
+		}
+		if (viewed != seen)
+			cout << "  MISMATCH: getEdgesFrom saw " << viewed << " segments" << endl;
+	}
+
+	// Snaps random points in and around the map to the nearest street, and checks a sample
+	// of them against a scan of every segment
+	void benchSnap(const StreetMap& sm)
+	{
+		const StreetGraph& g = StreetMapInternals::graph(sm);
+		if (g.numNodes == 0)
+			return;
+		double minLat = 90, maxLat = -90, minLon = 180, maxLon = -180;
+		for (uint32_t n = 0; n < g.numNodes; n++) {
+			minLat = min(minLat, g.coords[n].latitude());
+			maxLat = max(maxLat, g.coords[n].latitude());
+			minLon = min(minLon, g.coords[n].longitude());
+			maxLon = max(maxLon, g.coords[n].longitude());
+		}
+		// Half the points are within a few hundred feet of a map point, the way addresses are;
+		// the rest are anywhere in the map with a margin of a tenth of it on every side
+		double padLat = (maxLat - minLat) / 10, padLon = (maxLon - minLon) / 10;
+		mt19937 rng(21);
+		uniform_real_distribution<double> lat(minLat - padLat, maxLat + padLat), lon(minLon - padLon, maxLon + padLon), jitter(-0.001, 0.001);
+		uniform_int_distribution<uint32_t> pick(0, g.numNodes - 1);
+		const int numPoints = 100000;
+		vector<double> lats, lons;
+		for (int i = 0; i < numPoints; i++) {
+			if (i % 2 == 0) {
+				uint32_t n = pick(rng);
+				lats.push_back(g.coords[n].latitude() + jitter(rng));
+				lons.push_back(g.coords[n].longitude() + jitter(rng));
+			}
+			else {
+				lats.push_back(lat(rng));
+				lons.push_back(lon(rng));
+			}
+		}
+
+		// The first snap after a load builds the index
+		NetworkSnap snap;
+		auto start = chrono::steady_clock::now();
+		sm.snapToNetwork(lats[0], lons[0], snap);
+		double buildSeconds = secondsSince(start);
+		double seconds[2] = { 0, 0 }, miles[2] = { 0, 0 };
+		for (int kind = 0; kind < 2; kind++) {
+			start = chrono::steady_clock::now();
+			for (int i = kind; i < numPoints; i += 2) {
+				sm.snapToNetwork(lats[i], lons[i], snap);
+				miles[kind] += snap.distance;
+			}
+			seconds[kind] = secondsSince(start);
+		}
+
+		// The nearest point on every segment, measured the same way the index measures
+		int mismatches = 0;
+		const int numChecked = 1000;
+		for (int i = 0; i < numChecked; i++) {
+			double scale = cos(deg2rad(lats[i])), best = numeric_limits<double>::infinity();
+			for (uint32_t s = 0; s < g.numNodes; s++)
+				for (uint32_t e = g.edgeOffsets[s]; e < g.edgeOffsets[s + 1]; e++) {
+					FixedCoord a = g.coords[s], b = g.coords[g.edgeTargets[e]];
+					double ax = (a.longitude() - lons[i]) * scale, ay = a.latitude() - lats[i];
+					double dx = (b.longitude() - a.longitude()) * scale, dy = b.latitude() - a.latitude();
+					double lengthSquared = dx * dx + dy * dy;
+					double t = lengthSquared == 0 ? 0 : min(max(-(ax * dx + ay * dy) / lengthSquared, 0.0), 1.0);
+					best = min(best, (ax + t * dx) * (ax + t * dx) + (ay + t * dy) * (ay + t * dy));
+				}
+			sm.snapToNetwork(lats[i], lons[i], snap);
+			double dx = (snap.longitude - lons[i]) * scale, dy = snap.latitude - lats[i];
+			if (fabs(sqrt(dx * dx + dy * dy) - sqrt(best)) > 1e-9)
+				mismatches++;
+		}
+
+		cout << "Spatial index built on the first snap in " << buildSeconds * 1000 << " ms" << endl;
+		cout << "Snapping " << numPoints << " random points to the nearest street" << endl;
+		const char* labels[2] = { "near map points", "anywhere" };
+		for (int kind = 0; kind < 2; kind++)
+			cout << "  " << labels[kind] << ": " << seconds[kind] * 1e9 / (numPoints / 2) << " ns per point, "
+				<< miles[kind] / (numPoints / 2) << " miles away on average" << endl;
+		if (mismatches != 0)
+			cout << "  MISMATCH: " << mismatches << " of " << numChecked << " points snapped somewhere other than the nearest street" << endl;
+	}
+
+	// Fills crow-distance matrices with every batch kernel this processor runs and with
+	// distanceEarthMiles pair by pair, checking that the kernels agree with each other
+	// exactly and with distanceEarthMiles to within a millionth of a mile.  One set of
+	// points is in the map, the other anywhere on earth.
+	void benchCrowDistances(const StreetMap& sm, int numPoints)
+	{
+		mt19937 rng(24);
+		uniform_int_distribution<int> pick(0, sm.nodeCount() - 1);
+		uniform_real_distribution<double> anyLat(-90, 90), anyLon(-180, 180);
+		for (int kind = 0; kind < 2; kind++) {
+			vector<double> lats, lons;
+			for (int i = 0; i < numPoints; i++) {
+				if (kind == 0) {
+					GeoCoord gc = sm.getCoord(pick(rng));
+					lats.push_back(gc.latitude);
+					lons.push_back(gc.longitude);
+				}
+				else {
+					lats.push_back(anyLat(rng));
+					lons.push_back(anyLon(rng));
+				}
+			}
+			size_t cells = (size_t)numPoints * numPoints;
+
+			vector<double> reference(cells);
+			auto start = chrono::steady_clock::now();
+			for (int i = 0; i < numPoints; i++)
+				for (int j = 0; j < numPoints; j++)
+					reference[(size_t)i * numPoints + j] = distanceEarthMiles(lats[i], lons[i], lats[j], lons[j]);
+			double referenceSeconds = secondsSince(start);
+
+			cout << "Crow distances between " << numPoints << (kind == 0 ? " map points" : " points anywhere on earth") << endl;
+			cout << "  distanceEarthMiles: " << referenceSeconds * 1e9 / cells << " ns per distance" << endl;
+			GeoPointBatch batch;
+			batch.assign(lats.data(), lons.data(), numPoints);
+			vector<double> scalar, matrix(cells);
+			const DistanceKernel kernels[3] = { DISTANCE_SCALAR, DISTANCE_SSE2, DISTANCE_AVX };
+			for (int k = 0; k < 3; k++) {
+				if (!batch.setKernel(kernels[k]))
+					continue;
+				start = chrono::steady_clock::now();
+				batch.distanceMatrix(matrix.data());
+				double seconds = secondsSince(start);
+				double maxError = 0;
+				for (size_t c = 0; c < cells; c++)
+					maxError = max(maxError, fabs(matrix[c] - reference[c]));
+				cout << "  " << distanceKernelName(kernels[k]) << " kernel: " << seconds * 1e9 / cells << " ns per distance, "
+					<< referenceSeconds / seconds << " times as fast, at most " << maxError << " miles off" << endl;
+				if (maxError > 1e-6)
+					cout << "  MISMATCH: the " << distanceKernelName(kernels[k]) << " kernel is inaccurate" << endl;
+				if (kernels[k] == DISTANCE_SCALAR)
+					scalar = matrix;
+				else if (!sameArray(scalar.data(), matrix.data(), cells))
+					cout << "  MISMATCH: the " << distanceKernelName(kernels[k]) << " kernel differs from the scalar one" << endl;
+			}
+		}
+	}
+
+	template<typename Allocator>
+	void benchScratchMap(const vector<GeoCoord>& coords, const char* label)
+	{
+		const int rounds = 20;
+		ExpandableHashMap<GeoCoord, int, Allocator> map;
+		long long before = g_allocations;
+		auto start = chrono::steady_clock::now();
+		for (int round = 0; round < rounds; round++) {
+			for (size_t i = 0; i < coords.size(); i++)
+				map.associate(coords[i], (int)i);
+			map.reset();
+		}
+		double seconds = secondsSince(start);
+		cout << "  fill and reset with " << label << ": " << seconds * 1000 / rounds << " ms";
+		if (COUNTING_ALLOCATIONS)
+			cout << ", " << (double)(g_allocations - before) / rounds << " allocations per round";
+		cout << endl;
+	}
+
+	// Interns every point the way the map loader does, then looks each one up and erases them all
+	void benchHashMap(const StreetMap& sm)
+	{
+		vector<GeoCoord> coords;
+		for (int i = 0; i < sm.nodeCount(); i++)
+			coords.push_back(sm.getCoord(i));
+
+		ExpandableHashMap<GeoCoord, int> map;
+		long long before = g_allocations;
+		auto start = chrono::steady_clock::now();
+		for (size_t i = 0; i < coords.size(); i++)
+			map.associate(coords[i], (int)i);
+		double insertSeconds = secondsSince(start);
+		long long insertAllocations = g_allocations - before;
+
+		int misses = 0;
+		before = g_allocations;
+		start = chrono::steady_clock::now();
+		for (size_t i = 0; i < coords.size(); i++) {
+			const int* id = map.find(coords[i]);
+			if (id == nullptr || *id != (int)i)
+				misses++;
+		}
+		double findSeconds = secondsSince(start);
+		long long findAllocations = g_allocations - before;
+
+		start = chrono::steady_clock::now();
+		for (size_t i = 0; i < coords.size(); i++)
+			if (!map.erase(coords[i]))
+				misses++;
+		double eraseSeconds = secondsSince(start);
+
+		double n = (double)coords.size();
+		cout << "ExpandableHashMap<GeoCoord, int> over " << coords.size() << " points" << endl;
+		cout << "  associate: " << insertSeconds * 1e9 / n << " ns";
+		if (COUNTING_ALLOCATIONS)
+			cout << ", " << insertAllocations / n << " allocations each";
+		cout << endl << "  find:      " << findSeconds * 1e9 / n << " ns";
+		if (COUNTING_ALLOCATIONS)
+			cout << ", " << findAllocations / n << " allocations each";
+		cout << endl;
+		cout << "  erase:     " << eraseSeconds * 1e9 / n << " ns each" << endl;
+		if (misses != 0 || map.size() != 0)
+			cout << "  MISMATCH: " << misses << " lookups failed" << endl;
+
+		// The slowest single associate is the one that grows the table
+		const char* modes[] = { "growing all at once", "growing incrementally", "reserved up front" };
+		for (int mode = 0; mode < 3; mode++) {
+			ExpandableHashMap<GeoCoord, int> grown;
+			grown.setIncrementalRehash(mode == 1);
+			if (mode == 2)
+				grown.reserve((int)coords.size());
+			double slowest = 0;
+			for (size_t i = 0; i < coords.size(); i++) {
+				start = chrono::steady_clock::now();
+				grown.associate(coords[i], (int)i);
+				slowest = max(slowest, secondsSince(start));
+			}
+			cout << "  slowest associate " << modes[mode] << ": " << slowest * 1e6 << " us" << endl;
+		}
+
+		// A scratch map filled and reset over and over, the way a per-query table is used
+		benchScratchMap<HeapAllocator>(coords, "HeapAllocator");
+		benchScratchMap<ArenaAllocator>(coords, "ArenaAllocator");
+	}
+
+	// Fills a map with HashMapStats the way the loader does and prints what it saw: the
+	// points themselves, and the same points as the coordinate text in the map file
+	void benchHashMapStats(const StreetMap& sm)
+	{
+		ExpandableHashMap<GeoCoord, int, HeapAllocator, HashMapStats> coords;
+		ExpandableHashMap<string, int, HeapAllocator, HashMapStats> texts;
+		for (int i = 0; i < sm.nodeCount(); i++) {
+			GeoCoord gc = sm.getCoord(i);
+			coords.associate(gc, i);
+			texts.associate(gc.latitudeText + " " + gc.longitudeText, i);
+		}
+		for (int i = 0; i < sm.nodeCount(); i++) {
+			GeoCoord gc = sm.getCoord(i);
+			coords.find(gc);
+			texts.find(gc.latitudeText + " " + gc.longitudeText);
+		}
+		cout << "HashMapStats for ExpandableHashMap<GeoCoord, int>" << endl;
+		coords.stats().print(cout);
+		cout << "HashMapStats for ExpandableHashMap<string, int> of coordinate text" << endl;
+		texts.stats().print(cout);
+	}
+
+	// Looks every point up from several reader threads while a writer keeps rewriting and
+	// erasing entries, the mix a shared route cache sees.  Every value a reader gets back
+	// must be the one written for that key.
+	void benchConcurrentMap(const StreetMap& sm)
+	{
+		vector<GeoCoord> coords;
+		for (int i = 0; i < sm.nodeCount(); i++)
+			coords.push_back(sm.getCoord(i));
+		ConcurrentHashMap<GeoCoord, int> map;
+		for (size_t i = 0; i < coords.size(); i++)
+			map.associate(coords[i], (int)i);
+
+		cout << "ConcurrentHashMap<GeoCoord, int> over " << coords.size() << " points" << endl;
+		int maxThreads = max(1, (int)thread::hardware_concurrency());
+		for (int readers = 1; ; readers = min(readers * 2, maxThreads)) {
+			const int passes = 4;
+			atomic<long long> wrong(0);
+			atomic<bool> done(false);
+			// The writer only ever stores a key's own index, so a reader sees either that or nothing
+			thread writer([&]() {
+				for (size_t i = 0; !done; i = (i + 1) % coords.size()) {
+					if (i % 2 == 0)
+						map.associate(coords[i], (int)i);
+					else if (map.erase(coords[i]))
+						map.insert(coords[i], (int)i);
+				}
+			});
+			auto start = chrono::steady_clock::now();
+			vector<thread> threads;
+			for (int t = 0; t < readers; t++) {
+				threads.push_back(thread([&, t]() {
+					int value;
+					for (int pass = 0; pass < passes; pass++)
+						for (size_t i = t; i < coords.size(); i += readers)
+							if (map.find(coords[i], value) && value != (int)i)
+								wrong++;
+				}));
+			}
+			for (size_t t = 0; t < threads.size(); t++)
+				threads[t].join();
+			double seconds = secondsSince(start);
+			done = true;
+			writer.join();
+
+			cout << "  " << readers << " reader" << (readers == 1 ? "" : "s") << " and a writer: "
+				<< passes * coords.size() / seconds / 1e6 << " million finds per second" << endl;
+			if (wrong != 0)
+				cout << "  MISMATCH: " << wrong << " finds returned another key's value" << endl;
+			if (readers == maxThreads)
+				break;
+		}
+		if (map.size() != (int)coords.size())
+			cout << "  MISMATCH: " << map.size() << " entries after the writer stopped" << endl;
+	}
+
+	// Routes random pairs that the map's components say are unreachable, and checks with a
+	// full search that each really is; counts the pairs with no route that are left to a search
+	void benchUnreachable(const StreetMap& sm, int numPairs)
+	{
+		const StreetGraph& g = StreetMapInternals::graph(sm);
+		const ConnectedComponents& components = StreetMapInternals::components(sm);
+		vector<GeoCoord> starts, ends, unreachableStarts, unreachableEnds;
+		randomPairs(sm, numPairs, starts, ends);
+		vector<uint32_t> edges;
+		double distance;
+		int searched = 0;
+		for (int i = 0; i < numPairs; i++) {
+			NodeId start, end;
+			sm.getNodeId(starts[i], start);
+			sm.getNodeId(ends[i], end);
+			if (components.unreachable(start, end)) {
+				unreachableStarts.push_back(starts[i]);
+				unreachableEnds.push_back(ends[i]);
+			}
+			else if (!aStarSearch(g, start, end, edges, distance, nullptr))
+				searched++;
+		}
+		if (unreachableStarts.empty())
+			return;
+
+		PointToPointRouter router(&sm);
+		list<StreetSegment> route;
+		int noRoute = 0;
+		auto start = chrono::steady_clock::now();
+		for (size_t i = 0; i < unreachableStarts.size(); i++)
+			if (router.generatePointToPointRoute(unreachableStarts[i], unreachableEnds[i], route, distance) == NO_ROUTE)
+				noRoute++;
+		double checkedSeconds = secondsSince(start);
+
+		int found = 0;
+		start = chrono::steady_clock::now();
+		for (size_t i = 0; i < unreachableStarts.size(); i++) {
+			NodeId from, to;
+			sm.getNodeId(unreachableStarts[i], from);
+			sm.getNodeId(unreachableEnds[i], to);
+			if (aStarSearch(g, from, to, edges, distance, nullptr))
+				found++;
+		}
+		double searchedSeconds = secondsSince(start);
+
+		cout << "Unreachable pairs: " << unreachableStarts.size() << " of " << numPairs << " random pairs caught, "
+			<< searched << " more left to a search" << endl;
+		cout << "  " << checkedSeconds * 1e6 / unreachableStarts.size() << " us per NO_ROUTE with the component check, "
+			<< searchedSeconds * 1e6 / unreachableStarts.size() << " us searching" << endl;
+		if (noRoute != (int)unreachableStarts.size() || found != 0)
+			cout << "  MISMATCH: " << found << " of the pairs have routes" << endl;
+	}
+
+	// Routes random pairs with one algorithm and returns the nodes settled per query.  The
+	// distances and settled count of an earlier run, if given, are used to check that this
+	// algorithm finds routes just as short and to show how much less it expands.
+	double benchRoutes(const StreetMap& sm, int numQueries, RouteAlgorithm algorithm, const char* label,
+		vector<double>& distances, const vector<double>* expected, double expectedSettled = 0)
+	{
+		vector<GeoCoord> starts, ends;
+		randomPairs(sm, numQueries, starts, ends);
+		PointToPointRouter router(&sm);
+		router.setAlgorithm(algorithm);
+		list<StreetSegment> route;
+		double distance;
+		long long settled = 0, found = 0;
+		distances.assign(numQueries, -1);
+		long long before = g_allocations;
+		auto start = chrono::steady_clock::now();
+		for (int i = 0; i < numQueries; i++) {
+			RouteStats stats;
+			if (router.generatePointToPointRoute(starts[i], ends[i], route, distance, &stats) == DELIVERY_SUCCESS) {
+				found++;
+				distances[i] = distance;
+			}
+			settled += stats.nodesSettled;
+		}
+		double seconds = secondsSince(start);
+		long long allocations = g_allocations - before;
+
+		cout << label << " over " << numQueries << " random pairs (" << found << " routed)" << endl;
+		cout << "  " << seconds * 1e6 / numQueries << " us per query, " << (double)settled / numQueries << " nodes settled per query" << endl;
+		if (COUNTING_ALLOCATIONS)
+			cout << "  " << (double)allocations / numQueries << " allocations per query (including the returned route), "
+				<< (double)allocations / (settled == 0 ? 1 : settled) << " per expansion" << endl;
+		if (expected != nullptr) {
+			int mismatches = 0;
+			for (int i = 0; i < numQueries; i++)
+				if (abs(distances[i] - (*expected)[i]) > 1e-9)
+					mismatches++;
+			cout << "  " << mismatches << " routes differ in length from A*" << endl;
+			cout << "  " << 100 * (1 - (double)settled / numQueries / expectedSettled) << "% fewer nodes settled than A*" << endl;
+		}
+		return (double)settled / numQueries;
+	}
+
+	// Builds a road distance matrix over random points and checks it against routing every
+	// pair one at a time
+	void benchDistanceMatrix(const StreetMap& sm, int numPoints)
+	{
+		vector<GeoCoord> points, unused;
+		randomPairs(sm, numPoints, points, unused);
+		PointToPointRouter router(&sm);
+		vector<vector<double>> matrix;
+		auto start = chrono::steady_clock::now();
+		router.generateDistanceMatrix(points, matrix);
+		double seconds = secondsSince(start);
+
+		router.setAlgorithm(ROUTE_CONTRACTION_HIERARCHY);
+		list<StreetSegment> route;
+		double distance;
+		int mismatches = 0;
+		start = chrono::steady_clock::now();
+		for (int i = 0; i < numPoints; i++)
+			for (int j = 0; j < numPoints; j++) {
+				if (router.generatePointToPointRoute(points[i], points[j], route, distance) != DELIVERY_SUCCESS)
+					distance = numeric_limits<double>::infinity();
+				if (!(abs(matrix[i][j] - distance) <= 1e-9) && matrix[i][j] != distance)
+					mismatches++;
+			}
+		double pairwiseSeconds = secondsSince(start);
+
+		cout << "Distance matrix over " << numPoints << " points (" << sharedThreadPool().numThreads() << " threads)" << endl;
+		cout << "  " << seconds * 1000 << " ms, against " << pairwiseSeconds * 1000 << " ms routing each pair with the contraction hierarchy" << endl;
+		cout << "  " << mismatches << " entries differ from the routed distances" << endl;
+	}
+
+	// Orders random deliveries greedily, then with local search on top, checking that every
+	// delivery is still there
+	void benchDeliveryOrder(const StreetMap& sm, int numStops)
+	{
+		vector<GeoCoord> stops, unused;
+		randomPairs(sm, numStops + 1, stops, unused);
+		vector<DeliveryRequest> deliveries;
+		for (int i = 1; i <= numStops; i++)
+			deliveries.push_back(DeliveryRequest(to_string(i), stops[i]));
+
+		DeliveryOptimizer optimizer(&sm);
+		vector<DeliveryRequest> greedy = deliveries, improved = deliveries;
+		double oldCrow, greedyCrow, newCrow;
+		optimizer.setImprovementBudget(0, 0);
+		optimizer.optimizeDeliveryOrder(stops[0], greedy, oldCrow, greedyCrow);
+		optimizer.setImprovementBudget(1000000, 1);
+		auto start = chrono::steady_clock::now();
+		optimizer.optimizeDeliveryOrder(stops[0], improved, oldCrow, newCrow);
+		double seconds = secondsSince(start);
+
+		vector<int> seen(numStops + 1, 0);
+		for (size_t i = 0; i < improved.size(); i++)
+			seen[stoi(improved[i].item)]++;
+		cout << "Delivery order for " << numStops << " stops in " << seconds * 1000 << " ms" << endl;
+		cout << "  " << oldCrow << " crow miles as given, " << greedyCrow << " nearest neighbor, " << newCrow << " with local search" << endl;
+		if (improved.size() != deliveries.size() || count(seen.begin(), seen.end(), 1) != numStops)
+			cout << "  MISMATCH: deliveries were lost or repeated" << endl;
+	}
+
+	// Plans a random delivery run with the legs routed one after another and then on the
+	// thread pool, and checks that the two plans are the same.  The stops are all drawn from
+	// the largest strong component, since the planner turns away runs that span several.
+	void benchDeliveryPlan(const StreetMap& sm, int numStops)
+	{
+		vector<GeoCoord> stops = stopsInLargestComponent(sm, numStops + 1);
+		vector<DeliveryRequest> deliveries;
+		for (int i = 1; i <= numStops; i++)
+			deliveries.push_back(DeliveryRequest("item " + to_string(i), stops[i]));
+
+		DeliveryPlanner planner(&sm);
+		vector<DeliveryCommand> serial, parallel;
+		double serialMiles, parallelMiles;
+		auto start = chrono::steady_clock::now();
+		DeliveryResult result = planner.generateDeliveryPlan(stops[0], deliveries, serial, serialMiles);
+		double serialSeconds = secondsSince(start);
+
+		planner.setParallelRouting(true);
+		start = chrono::steady_clock::now();
+		planner.generateDeliveryPlan(stops[0], deliveries, parallel, parallelMiles);
+		double parallelSeconds = secondsSince(start);
+
+		bool same = serial.size() == parallel.size() && serialMiles == parallelMiles;
+		for (size_t i = 0; same && i < serial.size(); i++)
+			same = serial[i].description() == parallel[i].description();
+
+		// The plan should follow the optimizer's order: the deliveries come in that order, and
+		// the mileage is that of routing the legs in that order rather than as given
+		DeliveryOptimizer optimizer(&sm);
+		vector<DeliveryRequest> optimized = deliveries;
+		double oldCrow, newCrow;
+		optimizer.optimizeDeliveryOrder(stops[0], optimized, oldCrow, newCrow);
+		PointToPointRouter router(&sm);
+		vector<unsigned int> edges;
+		double givenMiles = 0, optimizedMiles = 0, legMiles;
+		for (int i = 0; i <= numStops; i++) {
+			const GeoCoord& from = i == 0 ? stops[0] : deliveries[i - 1].location;
+			const GeoCoord& to = i == numStops ? stops[0] : deliveries[i].location;
+			router.generatePointToPointEdgeRoute(from, to, edges, legMiles);
+			givenMiles += legMiles;
+			const GeoCoord& optimizedFrom = i == 0 ? stops[0] : optimized[i - 1].location;
+			const GeoCoord& optimizedTo = i == numStops ? stops[0] : optimized[i].location;
+			router.generatePointToPointEdgeRoute(optimizedFrom, optimizedTo, edges, legMiles);
+			optimizedMiles += legMiles;
+		}
+		int delivered = 0;
+		for (size_t i = 0; i < serial.size() && delivered < numStops; i++) {
+			DeliveryCommand expected;
+			expected.initAsDeliverCommand(optimized[delivered].item);
+			if (serial[i].description() == expected.description())
+				delivered++;
+		}
+
+		cout << "Delivery plan with " << numStops << " stops (" << sharedThreadPool().numThreads() << " threads)" << endl;
+		cout << "  " << serialSeconds * 1000 << " ms with the legs routed in turn, " << parallelSeconds * 1000 << " ms in parallel" << endl;
+		cout << "  " << serialMiles << " miles planned, against " << givenMiles << " in the order given" << endl;
+		if (result != DELIVERY_SUCCESS)
+			cout << "  MISMATCH: the run was turned away" << endl;
+		if (!same)
+			cout << "  MISMATCH: the parallel plan differs" << endl;
+		if (delivered != numStops || fabs(serialMiles - optimizedMiles) > 1e-9)
+			cout << "  MISMATCH: the plan doesn't follow the optimized order (" << optimizedMiles << " miles)" << endl;
+	}
+
+	// Routes random requests between a few hot spots with a cache too small to hold every
+	// pair, checking each answer against a router without one, then times a hit.  Loads the
+	// map again at the end to check that the cache notices.
+	void benchRouteCache(StreetMap& sm, const string& mapFile, int numSpots, int numRequests, int capacity)
+	{
+		vector<GeoCoord> spots, unused;
+		randomPairs(sm, numSpots, spots, unused);
+		mt19937 rng(25);
+		uniform_int_distribution<int> pick(0, numSpots - 1);
+		vector<pair<int, int>> requests;
+		for (int i = 0; i < numRequests; i++)
+			requests.push_back(make_pair(pick(rng), pick(rng)));
+
+		PointToPointRouter cached(&sm), uncached(&sm);
+		cached.setRouteCacheCapacity(capacity);
+		vector<vector<unsigned int>> expected(numRequests);
+		vector<double> expectedDistances(numRequests);
+		auto start = chrono::steady_clock::now();
+		for (int i = 0; i < numRequests; i++)
+			uncached.generatePointToPointEdgeRoute(spots[requests[i].first], spots[requests[i].second], expected[i], expectedDistances[i]);
+		double uncachedSeconds = secondsSince(start);
+
+		vector<unsigned int> edges;
+		double distance;
+		int mismatches = 0;
+		start = chrono::steady_clock::now();
+		for (int i = 0; i < numRequests; i++) {
+			cached.generatePointToPointEdgeRoute(spots[requests[i].first], spots[requests[i].second], edges, distance);
+			if (edges != expected[i] || distance != expectedDistances[i])
+				mismatches++;
+		}
+		double cachedSeconds = secondsSince(start);
+		RouteCacheStats stats = cached.routeCacheStats();
+
+		// The same request over and over, so every call is a hit
+		int longest = 0;
+		for (int i = 1; i < numRequests; i++)
+			if (expected[i].size() > expected[longest].size())
+				longest = i;
+		const GeoCoord& from = spots[requests[longest].first];
+		const GeoCoord& to = spots[requests[longest].second];
+		const int numHits = 100000;
+		start = chrono::steady_clock::now();
+		for (int i = 0; i < numHits; i++)
+			cached.generatePointToPointEdgeRoute(from, to, edges, distance);
+		double edgeHitSeconds = secondsSince(start);
+		list<StreetSegment> route;
+		start = chrono::steady_clock::now();
+		for (int i = 0; i < numHits / 10; i++)
+			cached.generatePointToPointRoute(from, to, route, distance);
+		double segmentHitSeconds = secondsSince(start) * 10;
+
+		cout << "Route cache of " << capacity << " routes over " << numRequests << " requests between " << numSpots << " hot spots" << endl;
+		cout << "  " << cachedSeconds * 1e6 / numRequests << " us per request, against " << uncachedSeconds * 1e6 / numRequests << " us without the cache" << endl;
+		cout << "  " << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions << " evictions, " << stats.size << " routes held" << endl;
+		cout << "  A hit on a route of " << expected[longest].size() << " segments: " << edgeHitSeconds * 1e9 / numHits << " ns as segment ids, "
+			<< segmentHitSeconds * 1e9 / numHits << " ns as StreetSegments" << endl;
+		if (mismatches != 0)
+			cout << "  MISMATCH: " << mismatches << " cached routes differ from searched ones" << endl;
+
+		long long missesBefore = cached.routeCacheStats().misses;
+		if (sm.load(mapFile)) {
+			cached.generatePointToPointEdgeRoute(from, to, edges, distance);
+			stats = cached.routeCacheStats();
+			if (stats.invalidations != 1 || stats.misses != missesBefore + 1 || edges != expected[longest])
+				cout << "  MISMATCH: the cache didn't drop its routes when the map was loaded again" << endl;
+		}
+	}
+
+	// Runs body(t) on numThreads threads at once, releasing them together so their first
+	// steps overlap as much as they can
+	void runTogether(int numThreads, const function<void(int)>& body)
+	{
+		atomic<int> waiting(numThreads);
+		vector<thread> threads;
+		for (int t = 0; t < numThreads; t++)
+			threads.push_back(thread([&, t]() {
+				waiting--;
+				while (waiting > 0)
+					this_thread::yield();
+				body(t);
+			}));
+		for (size_t t = 0; t < threads.size(); t++)
+			threads[t].join();
+	}
+
+	// Every thread mixes finds, writes, erases and size counts over a few keys, so they
+	// keep landing on the same shards; one thread now and then resets the whole map.  A key
+	// is only ever stored with its own index, so a find sees that or nothing.
+	int stressConcurrentMap(const StreetMap& sm, int numThreads, int opsPerThread)
+	{
+		const int numKeys = min(sm.nodeCount(), 512);
+		vector<GeoCoord> keys;
+		for (int i = 0; i < numKeys; i++)
+			keys.push_back(sm.getCoord(i));
+		ConcurrentHashMap<GeoCoord, int> map;
+		atomic<long long> wrong(0);
+		runTogether(numThreads, [&](int t) {
+			mt19937 rng(t);
+			uniform_int_distribution<int> pickKey(0, numKeys - 1), pickOp(0, 9);
+			int value;
+			for (int i = 0; i < opsPerThread; i++) {
+				int k = pickKey(rng);
+				switch (pickOp(rng)) {
+				case 0:
+					map.associate(keys[k], k);
+					break;
+				case 1:
+					map.insert(keys[k], k);
+					break;
+				case 2:
+					map.erase(keys[k]);
+					break;
+				case 3:
+					if (map.size() > numKeys)
+						wrong++;
+					break;
+				case 4:
+					if (t == 0 && i % 1000 == 0)
+						map.reset();
+					break;
+				default:
+					if (map.find(keys[k], value) && value != k)
+						wrong++;
+				}
+			}
+		});
+		int value;
+		for (int k = 0; k < numKeys; k++)
+			if (map.find(keys[k], value) && value != k)
+				wrong++;
+
+		cout << "ConcurrentHashMap: " << numThreads << " threads, " << opsPerThread << " operations each over " << numKeys << " keys" << endl;
+		if (wrong != 0)
+			cout << "  MISMATCH: " << wrong << " finds or sizes were impossible" << endl;
+		return wrong != 0;
+	}
+
+	// Every thread asks one router, with a cache too small for every pair, for the same
+	// requests in its own order, while another clears the cache now and then; each answer
+	// must match a router without a cache
+	int stressSharedRouter(const StreetMap& sm, int numThreads, int numRequests)
+	{
+		vector<GeoCoord> spots = stopsInLargestComponent(sm, 12);
+		mt19937 rng(16);
+		uniform_int_distribution<int> pick(0, (int)spots.size() - 1);
+		vector<pair<int, int>> requests;
+		for (int i = 0; i < numRequests; i++)
+			requests.push_back(make_pair(pick(rng), pick(rng)));
+		PointToPointRouter uncached(&sm);
+		vector<vector<unsigned int>> expected(numRequests);
+		vector<double> expectedDistances(numRequests);
+		for (int i = 0; i < numRequests; i++)
+			uncached.generatePointToPointEdgeRoute(spots[requests[i].first], spots[requests[i].second], expected[i], expectedDistances[i]);
+
+		PointToPointRouter router(&sm);
+		router.setRouteCacheCapacity(20);
+		atomic<long long> wrong(0);
+		atomic<int> finished(0);
+		runTogether(numThreads + 1, [&](int t) {
+			if (t == numThreads) {
+				while (finished < numThreads) {
+					router.clearRouteCache();
+					router.routeCacheStats();
+					this_thread::yield();
+				}
+				return;
+			}
+			vector<unsigned int> edges;
+			double distance;
+			for (int k = 0; k < numRequests; k++) {
+				int i = (k + t * numRequests / numThreads) % numRequests;
+				router.generatePointToPointEdgeRoute(spots[requests[i].first], spots[requests[i].second], edges, distance);
+				if (edges != expected[i] || distance != expectedDistances[i])
+					wrong++;
+			}
+			finished++;
+		});
+
+		RouteCacheStats stats = router.routeCacheStats();
+		cout << "Shared router: " << numThreads << " threads, " << numRequests << " requests each, "
+			<< stats.hits << " cache hits, " << stats.invalidations << " invalidations" << endl;
+		if (wrong != 0)
+			cout << "  MISMATCH: " << wrong << " routes differ from a router without a cache" << endl;
+		return wrong != 0;
+	}
+
+	// Loads the map afresh and has every thread need each piece of preprocessing at once, so
+	// they race to build it; every thread must get the same answers
+	int stressFirstUse(const string& mapFile, int numThreads)
+	{
+		StreetMap sm;
+		if (!sm.load(mapFile))
+			return 1;
+		vector<GeoCoord> ends = stopsInLargestComponent(sm, 2);
+		double offMapLat = ends[0].latitude + 0.0005, offMapLon = ends[0].longitude + 0.0005;
+		const RouteAlgorithm algorithms[] = { ROUTE_ASTAR, ROUTE_CONTRACTION_HIERARCHY, ROUTE_LANDMARKS };
+		const int numAlgorithms = 3;
+		// Each thread's snapped distance, then its route's length by each algorithm
+		vector<vector<double>> answers(numThreads, vector<double>(numAlgorithms + 1, 0));
+		runTogether(numThreads, [&](int t) {
+			NetworkSnap snap;
+			sm.snapToNetwork(offMapLat, offMapLon, snap);
+			answers[t][0] = snap.distance;
+			for (int a = 0; a < numAlgorithms; a++) {
+				PointToPointRouter router(&sm);
+				router.setAlgorithm(algorithms[(a + t) % numAlgorithms]);
+				vector<unsigned int> edges;
+				router.generatePointToPointEdgeRoute(ends[0], ends[1], edges, answers[t][1 + (a + t) % numAlgorithms]);
+			}
+		});
+
+		int wrong = 0;
+		for (int t = 1; t < numThreads; t++)
+			if (answers[t] != answers[0])
+				wrong++;
+		cout << "First use: " << numThreads << " threads building the spatial index, components, contraction hierarchy and landmarks" << endl;
+		if (wrong != 0)
+			cout << "  MISMATCH: " << wrong << " threads got different answers" << endl;
+		return wrong != 0;
+	}
+
+	// Several planners at once, each routing its legs on the shared thread pool
+	int stressParallelPlanners(const StreetMap& sm, int numThreads, int numStops)
+	{
+		vector<GeoCoord> stops = stopsInLargestComponent(sm, numStops + 1);
+		vector<DeliveryRequest> deliveries;
+		for (int i = 1; i <= numStops; i++)
+			deliveries.push_back(DeliveryRequest("item " + to_string(i), stops[i]));
+		DeliveryPlanner serialPlanner(&sm);
+		vector<DeliveryCommand> expected;
+		double expectedMiles;
+		serialPlanner.generateDeliveryPlan(stops[0], deliveries, expected, expectedMiles);
+
+		atomic<int> wrong(0);
+		runTogether(numThreads, [&](int) {
+			DeliveryPlanner planner(&sm);
+			planner.setParallelRouting(true);
+			vector<DeliveryCommand> commands;
+			double miles;
+			DeliveryResult result = planner.generateDeliveryPlan(stops[0], deliveries, commands, miles);
+			bool same = result == DELIVERY_SUCCESS && commands.size() == expected.size() && miles == expectedMiles;
+			for (size_t i = 0; same && i < commands.size(); i++)
+				same = commands[i].description() == expected[i].description();
+			if (!same)
+				wrong++;
+		});
+
+		cout << "Parallel planners: " << numThreads << " threads planning " << numStops << " stops each" << endl;
+		if (wrong != 0)
+			cout << "  MISMATCH: " << wrong << " plans differ from one made on a single thread" << endl;
+		return wrong != 0;
+	}
+}
+
+#if defined(BENCHMARK_COUNT_ALLOCATIONS)
+void* operator new(size_t size)
+{
+	g_allocations.fetch_add(1, memory_order_relaxed);
+	void* p = malloc(size == 0 ? 1 : size);
+	if (p == nullptr)
+		throw bad_alloc();
+	return p;
+}
+
+// GCC can't see that the operator new above uses malloc, so it flags these frees
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+#endif
+
+int runBenchmarks(string mapFile)
+{
+	StreetMap sm;
+	auto start = chrono::steady_clock::now();
+	if (!sm.load(mapFile)) {
+		cout << "Unable to load map data file " << mapFile << endl;
+		return 1;
+	}
+	cout << "Loaded " << mapFile << " (" << sm.nodeCount() << " points) in " << secondsSince(start) * 1000 << " ms" << endl;
+	if (!isMapFile(mapFile))
+		benchParse(mapFile);
+
+	benchNeighborAccess(sm);
+	benchSnap(sm);
+	benchCrowDistances(sm, 2000);
+	benchHashMap(sm);
+	benchHashMapStats(sm);
+	benchConcurrentMap(sm);
+
+	// Routers turn away unreachable pairs with the components, so the first route builds them
+	start = chrono::steady_clock::now();
+	const ConnectedComponents& components = StreetMapInternals::components(sm);
+	cout << "Components built in " << secondsSince(start) * 1000 << " ms (" << components.numStrongComponents() << " strong, "
+		<< components.numWeakComponents() << " weak, " << components.bytesUsed() << " bytes)" << endl;
+	vector<double> reference, distances;
+	double referenceSettled = benchRoutes(sm, 1000, ROUTE_ASTAR, "A*", reference, nullptr);
+	benchRoutes(sm, 1000, ROUTE_BIDIRECTIONAL, "Bidirectional A*", distances, &reference, referenceSettled);
+	benchUnreachable(sm, 1000);
+
+	start = chrono::steady_clock::now();
+	int shortcuts = StreetMapInternals::contractionHierarchy(sm).numShortcuts();
+	cout << "Contraction hierarchy built in " << secondsSince(start) * 1000 << " ms (" << shortcuts << " shortcuts)" << endl;
+	benchRoutes(sm, 1000, ROUTE_CONTRACTION_HIERARCHY, "Contraction hierarchy", distances, &reference, referenceSettled);
+
+	start = chrono::steady_clock::now();
+	int landmarks = StreetMapInternals::landmarks(sm).numLandmarks();
+	cout << "Landmark tables built in " << secondsSince(start) * 1000 << " ms (" << landmarks << " landmarks)" << endl;
+	benchRoutes(sm, 1000, ROUTE_LANDMARKS, "Landmark A*", distances, &reference, referenceSettled);
+	benchDistanceMatrix(sm, 60);
+	benchDeliveryPlan(sm, 60);
+	benchDeliveryOrder(sm, 60);
+	benchDeliveryOrder(sm, 1000);
+	// Last, since it loads the map again
+	benchRouteCache(sm, mapFile, 20, 2000, 200);
+	return 0;
+}
+
+int runStressTests(string mapFile)
+{
+	StreetMap sm;
+	if (!sm.load(mapFile)) {
+		cout << "Unable to load map data file " << mapFile << endl;
+		return 1;
+	}
+	// More threads than cores, so threads are preempted in the middle of things too
+	int numThreads = max(4, (int)thread::hardware_concurrency());
+	int failures = 0;
+	failures += stressConcurrentMap(sm, numThreads, 20000);
+	failures += stressSharedRouter(sm, numThreads, 200);
+	failures += stressFirstUse(mapFile, numThreads);
+	failures += stressParallelPlanners(sm, numThreads, 20);
+	cout << (failures == 0 ? "All stress tests passed" : "Some stress tests failed") << endl;
+	return failures == 0 ? 0 : 1;
+}
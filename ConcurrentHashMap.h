@@ -0,0 +1,131 @@
+// ConcurrentHashMap.h
+
+// A hash map that many threads can use at once, for lookup tables shared between
+// planners such as route and distance caches.  Keys are spread by hash over a fixed set
+// of shards, each an ExpandableHashMap behind its own reader-writer lock, so readers
+// only ever wait on a writer to the same shard and lookups scale with the number of cores.
+//
+// Since another thread may change an entry at any moment, find copies the value out
+// instead of returning a pointer into the map.
+#ifndef CONCURRENTHASHMAP_H
+#define CONCURRENTHASHMAP_H
+
+#include "ExpandableHashMap.h"
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+
+template<typename KeyType, typename ValueType, int NUM_SHARDS = 64>
+class ConcurrentHashMap
+{
+public:
+	ConcurrentHashMap(double maximumLoadFactor = 0.5);
+	~ConcurrentHashMap();
+	void reset();
+	int size() const; // Exact only when no other thread is changing the map
+	void associate(const KeyType& key, const ValueType& value);
+	bool erase(const KeyType& key); // Returns false if key wasn't in the map
+
+	// Copies key's value into value and returns true, or returns false if key isn't there
+	bool find(const KeyType& key, ValueType& value) const;
+	// If key isn't in the map, adds it with value.  Returns false if it was already there.
+	bool insert(const KeyType& key, const ValueType& value);
+
+	ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+	ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+private:
+	// Each shard gets its own cache lines, so threads working on different shards don't
+	// slow each other down by writing to the same line
+	struct alignas(64) Shard {
+		Shard(double maximumLoadFactor) : map(maximumLoadFactor) {}
+		mutable std::shared_mutex lock;
+		ExpandableHashMap<KeyType, ValueType> map;
+	};
+	Shard* m_shards[NUM_SHARDS];
+
+	static_assert(NUM_SHARDS >= 2 && (NUM_SHARDS & (NUM_SHARDS - 1)) == 0, "NUM_SHARDS must be a power of two");
+	static constexpr int shardBits() { int bits = 0; while ((1 << bits) < NUM_SHARDS) bits++; return bits; }
+
+	// Picks the shard from the top bits of the 32-bit hash after mixing, since the shard's
+	// own table uses the low bits
+	static int shardOf(unsigned int h) { return (int)((uint32_t)(h * 2654435769u) >> (32 - shardBits())); }
+};
+
+template<typename KeyType, typename ValueType, int NUM_SHARDS>
+ConcurrentHashMap<KeyType, ValueType, NUM_SHARDS>::ConcurrentHashMap(double maximumLoadFactor)
+{
+	for (int i = 0; i < NUM_SHARDS; i++)
+		m_shards[i] = new Shard(maximumLoadFactor);
+}
+
+template<typename KeyType, typename ValueType, int NUM_SHARDS>
+ConcurrentHashMap<KeyType, ValueType, NUM_SHARDS>::~ConcurrentHashMap()
+{
+	for (int i = 0; i < NUM_SHARDS; i++)
+		delete m_shards[i];
+}
+
+template<typename KeyType, typename ValueType, int NUM_SHARDS>
+void ConcurrentHashMap<KeyType, ValueType, NUM_SHARDS>::reset()
+{
+	for (int i = 0; i < NUM_SHARDS; i++) {
+		std::lock_guard<std::shared_mutex> lock(m_shards[i]->lock);
+		m_shards[i]->map.reset();
+	}
+}
+
+template<typename KeyType, typename ValueType, int NUM_SHARDS>
+int ConcurrentHashMap<KeyType, ValueType, NUM_SHARDS>::size() const
+{
+	int total = 0;
+	for (int i = 0; i < NUM_SHARDS; i++) {
+		std::shared_lock<std::shared_mutex> lock(m_shards[i]->lock);
+		total += m_shards[i]->map.size();
+	}
+	return total;
+}
+
+template<typename KeyType, typename ValueType, int NUM_SHARDS>
+void ConcurrentHashMap<KeyType, ValueType, NUM_SHARDS>::associate(const KeyType& key, const ValueType& value)
+{
+	unsigned int hasher(const KeyType & key);
+	unsigned int h = hasher(key);
+	Shard& shard = *m_shards[shardOf(h)];
+	std::lock_guard<std::shared_mutex> lock(shard.lock);
+	shard.map.associate(key, value, h);
+}
+
+template<typename KeyType, typename ValueType, int NUM_SHARDS>
+bool ConcurrentHashMap<KeyType, ValueType, NUM_SHARDS>::erase(const KeyType& key)
+{
+	unsigned int hasher(const KeyType & key);
+	Shard& shard = *m_shards[shardOf(hasher(key))];
+	std::lock_guard<std::shared_mutex> lock(shard.lock);
+	return shard.map.erase(key);
+}
+
+template<typename KeyType, typename ValueType, int NUM_SHARDS>
+bool ConcurrentHashMap<KeyType, ValueType, NUM_SHARDS>::find(const KeyType& key, ValueType& value) const
+{
+	unsigned int hasher(const KeyType & key);
+	unsigned int h = hasher(key);
+	const Shard& shard = *m_shards[shardOf(h)];
+	std::shared_lock<std::shared_mutex> lock(shard.lock);
+	const ValueType* found = shard.map.find(key, h);
+	if (found == nullptr)
+		return false;
+	value = *found;
+	return true;
+}
+
+template<typename KeyType, typename ValueType, int NUM_SHARDS>
+bool ConcurrentHashMap<KeyType, ValueType, NUM_SHARDS>::insert(const KeyType& key, const ValueType& value)
+{
+	unsigned int hasher(const KeyType & key);
+	Shard& shard = *m_shards[shardOf(hasher(key))];
+	std::lock_guard<std::shared_mutex> lock(shard.lock);
+	return shard.map.try_emplace(key, value).second;
+}
+
+#endif
@@ -0,0 +1,118 @@
+#include "ConnectedComponents.h"
+#include <algorithm>
+#include <utility>
+using namespace std;
+
+ConnectedComponents::ConnectedComponents()
+{
+	m_numStrong = 0;
+	m_numWeak = 0;
+}
+
+void ConnectedComponents::build(const StreetGraph& g)
+{
+	const uint32_t UNVISITED = 0xFFFFFFFF;
+	m_numStrong = 0;
+	m_numWeak = 0;
+	m_strong.assign(g.numNodes, UNVISITED);
+	m_weak.assign(g.numNodes, UNVISITED);
+
+	// Tarjan's algorithm, with an explicit stack so long chains of points can't overflow the
+	// call stack.  Each frame is a point and the next of its edges to follow.
+	vector<uint32_t> order(g.numNodes, UNVISITED); // When each point was first reached
+	vector<uint32_t> low(g.numNodes); // Earliest point still on the stack that each point's subtree reaches
+	vector<NodeId> stack; // Reached points whose components aren't finished, in the order reached
+	vector<pair<NodeId, uint32_t>> frames;
+	uint32_t nextOrder = 0;
+	for (NodeId root = 0; root < g.numNodes; root++) {
+		if (order[root] != UNVISITED)
+			continue;
+		frames.push_back(make_pair(root, g.edgeOffsets[root]));
+		order[root] = low[root] = nextOrder++;
+		stack.push_back(root);
+		while (!frames.empty()) {
+			NodeId n = frames.back().first;
+			uint32_t& e = frames.back().second;
+			if (e < g.edgeOffsets[n + 1]) {
+				NodeId next = g.edgeTargets[e++];
+				if (order[next] == UNVISITED) {
+					order[next] = low[next] = nextOrder++;
+					stack.push_back(next);
+					frames.push_back(make_pair(next, g.edgeOffsets[next]));
+				}
+				else if (m_strong[next] == UNVISITED) // Still on the stack
+					low[n] = min(low[n], order[next]);
+				continue;
+			}
+
+			// Every edge is followed; n heads a component if nothing below it reached higher
+			frames.pop_back();
+			if (!frames.empty())
+				low[frames.back().first] = min(low[frames.back().first], low[n]);
+			if (low[n] == order[n]) {
+				NodeId member;
+				do {
+					member = stack.back();
+					stack.pop_back();
+					m_strong[member] = m_numStrong;
+				} while (member != n);
+				m_numStrong++;
+			}
+		}
+	}
+
+	buildLowest(g);
+
+	// Weak components, flooding across edges both ways
+	for (NodeId root = 0; root < g.numNodes; root++) {
+		if (m_weak[root] != UNVISITED)
+			continue;
+		m_weak[root] = m_numWeak;
+		stack.push_back(root);
+		while (!stack.empty()) {
+			NodeId n = stack.back();
+			stack.pop_back();
+			for (uint32_t e = g.edgeOffsets[n]; e < g.edgeOffsets[n + 1]; e++)
+				if (m_weak[g.edgeTargets[e]] == UNVISITED) {
+					m_weak[g.edgeTargets[e]] = m_numWeak;
+					stack.push_back(g.edgeTargets[e]);
+				}
+			for (uint32_t r = g.reverseOffsets[n]; r < g.reverseOffsets[n + 1]; r++)
+				if (m_weak[g.reverseSources[r]] == UNVISITED) {
+					m_weak[g.reverseSources[r]] = m_numWeak;
+					stack.push_back(g.reverseSources[r]);
+				}
+		}
+		m_numWeak++;
+	}
+}
+
+size_t ConnectedComponents::bytesUsed() const
+{
+	return (m_strong.size() + m_weak.size()) * sizeof(uint32_t) + m_lowest.size() * sizeof(uint32_t);
+}
+
+void ConnectedComponents::buildLowest(const StreetGraph& g)
+{
+	// The points of each component, grouped by a counting sort
+	vector<uint32_t> memberOffsets(m_numStrong + 1, 0);
+	for (NodeId n = 0; n < g.numNodes; n++)
+		memberOffsets[m_strong[n] + 1]++;
+	for (uint32_t c = 0; c < m_numStrong; c++)
+		memberOffsets[c + 1] += memberOffsets[c];
+	vector<NodeId> members(g.numNodes);
+	vector<uint32_t> next(memberOffsets.begin(), memberOffsets.end() - 1);
+	for (NodeId n = 0; n < g.numNodes; n++)
+		members[next[m_strong[n]]++] = n;
+
+	// Every edge out of component c leads to a lower-numbered one, whose lowest is final
+	m_lowest.resize(m_numStrong);
+	for (uint32_t c = 0; c < m_numStrong; c++) {
+		m_lowest[c] = c;
+		for (uint32_t m = memberOffsets[c]; m < memberOffsets[c + 1]; m++) {
+			NodeId n = members[m];
+			for (uint32_t e = g.edgeOffsets[n]; e < g.edgeOffsets[n + 1]; e++)
+				m_lowest[c] = min(m_lowest[c], m_lowest[m_strong[g.edgeTargets[e]]]);
+		}
+	}
+}
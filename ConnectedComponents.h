@@ -0,0 +1,52 @@
+// ConnectedComponents.h
+
+// Which points of a StreetGraph can reach which, for turning away impossible routes
+// without searching.  Strong components are found with Tarjan's algorithm, which finishes
+// a component only after every component it leads to, so an edge between two components
+// always runs from a higher-numbered one to a lower-numbered one.  Each component also
+// keeps the lowest-numbered component it reaches, so everything it reaches is numbered
+// within [lowest, itself]; a component outside that range, or one whose own range isn't
+// inside it, can't be reached.  Weak components (the pieces the map falls into when every
+// segment runs both ways) catch the pairs that neither test can.  All of it is a few words
+// per point or component; pairs none of it rules out are left to a search.
+#ifndef CONNECTEDCOMPONENTS_H
+#define CONNECTEDCOMPONENTS_H
+
+#include "provided.h"
+#include "StreetGraph.h"
+#include <cstdint>
+#include <vector>
+
+class ConnectedComponents
+{
+public:
+	ConnectedComponents();
+	void build(const StreetGraph& g);
+
+	uint32_t numStrongComponents() const { return m_numStrong; }
+	uint32_t numWeakComponents() const { return m_numWeak; }
+	uint32_t strongComponent(NodeId n) const { return m_strong[n]; }
+	uint32_t weakComponent(NodeId n) const { return m_weak[n]; }
+
+	// Whether each of two points can reach the other
+	bool mutuallyReachable(NodeId a, NodeId b) const { return m_strong[a] == m_strong[b]; }
+	// Whether no path at all leads from start to end.  A false answer for points in different
+	// strong components only means a search has to decide.
+	bool unreachable(NodeId start, NodeId end) const
+	{
+		uint32_t from = m_strong[start], to = m_strong[end];
+		return m_weak[start] != m_weak[end] || from < to || m_lowest[to] < m_lowest[from];
+	}
+
+	size_t bytesUsed() const;
+private:
+	uint32_t m_numStrong;
+	uint32_t m_numWeak;
+	std::vector<uint32_t> m_strong; // Strong component of each point, numbered in the order Tarjan's algorithm finishes them
+	std::vector<uint32_t> m_weak; // Weak component of each point
+	std::vector<uint32_t> m_lowest; // Lowest-numbered strong component each strong component reaches
+
+	void buildLowest(const StreetGraph& g);
+};
+
+#endif
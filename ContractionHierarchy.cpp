@@ -0,0 +1,241 @@
+#include "ContractionHierarchy.h"
+#include <algorithm>
+#include <limits>
+using namespace std;
+
+namespace {
+	const int WITNESS_SETTLE_LIMIT = 500; // A missed witness only costs an extra shortcut
+
+	// Builds CSR offsets and entries from (node, edge) pairs
+	void buildLists(uint32_t numNodes, const vector<pair<uint32_t, uint32_t>>& pairs,
+		vector<uint32_t>& offsets, vector<uint32_t>& entries)
+	{
+		offsets.assign(numNodes + 1, 0);
+		for (size_t i = 0; i < pairs.size(); i++)
+			offsets[pairs[i].first + 1]++;
+		for (uint32_t i = 0; i < numNodes; i++)
+			offsets[i + 1] += offsets[i];
+		entries.resize(pairs.size());
+		vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < pairs.size(); i++)
+			entries[next[pairs[i].first]++] = pairs[i].second;
+	}
+
+	void removeEdge(vector<uint32_t>& list, uint32_t edge)
+	{
+		list.erase(find(list.begin(), list.end(), edge));
+	}
+}
+
+ContractionHierarchy::ContractionHierarchy()
+{
+	m_numNodes = 0;
+	m_numShortcuts = 0;
+}
+
+void ContractionHierarchy::build(const StreetGraph& g)
+{
+	m_numNodes = g.numNodes;
+	m_numShortcuts = 0;
+	m_edges.clear();
+
+	// Adjacency of the nodes not contracted yet, as ids into m_edges
+	vector<vector<uint32_t>> out(g.numNodes), in(g.numNodes);
+	for (uint32_t u = 0; u < g.numNodes; u++) {
+		for (uint32_t e = g.edgeOffsets[u]; e < g.edgeOffsets[u + 1]; e++) {
+			if (g.edgeTargets[e] == u)
+				continue;
+			Edge edge = { u, g.edgeTargets[e], g.edgeLengths[e], e, NO_EDGE, NO_EDGE };
+			out[u].push_back((uint32_t)m_edges.size());
+			in[edge.to].push_back((uint32_t)m_edges.size());
+			m_edges.push_back(edge);
+		}
+	}
+
+	// Orders nodes by edge difference (shortcuts added minus edges removed), plus the number
+	// of contracted neighbors to spread contraction evenly over the map
+	SearchSpace witness;
+	vector<int> contractedNeighbors(g.numNodes, 0);
+	auto priority = [&](uint32_t v) {
+		return (double)(contract(v, false, out, in, witness) - (int)(out[v].size() + in[v].size()) + contractedNeighbors[v]);
+	};
+	IndexedHeap<4> queue;
+	queue.resize(g.numNodes);
+	for (uint32_t v = 0; v < g.numNodes; v++)
+		queue.pushOrDecrease(v, priority(v));
+
+	m_rank.assign(g.numNodes, 0);
+	uint32_t nextRank = 0;
+	while (!queue.empty()) {
+		uint32_t v = queue.pop();
+		// Priorities go stale as neighbors are contracted, so recheck before committing
+		double current = priority(v);
+		if (!queue.empty() && current > queue.topKey()) {
+			queue.pushOrDecrease(v, current);
+			continue;
+		}
+		contract(v, true, out, in, witness);
+		m_rank[v] = nextRank++;
+
+		// Detaches v from the remaining graph
+		for (size_t i = 0; i < in[v].size(); i++) {
+			uint32_t u = m_edges[in[v][i]].from;
+			removeEdge(out[u], in[v][i]);
+			contractedNeighbors[u]++;
+		}
+		for (size_t i = 0; i < out[v].size(); i++) {
+			uint32_t x = m_edges[out[v][i]].to;
+			removeEdge(in[x], out[v][i]);
+			contractedNeighbors[x]++;
+		}
+		out[v].clear();
+		in[v].clear();
+	}
+
+	// Every edge leads upward from exactly one of its ends
+	vector<pair<uint32_t, uint32_t>> upOut, upIn;
+	for (uint32_t e = 0; e < m_edges.size(); e++) {
+		if (m_rank[m_edges[e].to] > m_rank[m_edges[e].from])
+			upOut.push_back(make_pair(m_edges[e].from, e));
+		else
+			upIn.push_back(make_pair(m_edges[e].to, e));
+	}
+	buildLists(g.numNodes, upOut, m_upOutOffsets, m_upOut);
+	buildLists(g.numNodes, upIn, m_upInOffsets, m_upIn);
+}
+
+int ContractionHierarchy::contract(uint32_t v, bool apply, vector<vector<uint32_t>>& out,
+	vector<vector<uint32_t>>& in, SearchSpace& witness)
+{
+	int shortcuts = 0;
+	double maxOut = 0;
+	for (size_t j = 0; j < out[v].size(); j++)
+		maxOut = max(maxOut, m_edges[out[v][j]].weight);
+
+	for (size_t i = 0; i < in[v].size(); i++) {
+		uint32_t inEdge = in[v][i];
+		uint32_t u = m_edges[inEdge].from;
+		double inWeight = m_edges[inEdge].weight;
+
+		// Dijkstra from u around v, far enough to cover every path through v
+		double limit = inWeight + maxOut;
+		witness.begin(m_numNodes);
+		witness.reach(u, 0, NO_NODE, 0);
+		witness.heap.pushOrDecrease(u, 0);
+		for (int settled = 0; !witness.heap.empty() && witness.heap.topKey() <= limit && settled < WITNESS_SETTLE_LIMIT; settled++) {
+			uint32_t cur = witness.heap.pop();
+			witness.settle(cur);
+			for (size_t k = 0; k < out[cur].size(); k++) {
+				const Edge& e = m_edges[out[cur][k]];
+				if (e.to == v || witness.settled(e.to))
+					continue;
+				double d = witness.distance(cur) + e.weight;
+				if (d < witness.distance(e.to)) {
+					witness.reach(e.to, d, cur, 0);
+					witness.heap.pushOrDecrease(e.to, d);
+				}
+			}
+		}
+
+		// Indexes rather than iterators, since adding shortcuts may grow out[v]'s neighbors' lists
+		for (size_t j = 0; j < out[v].size(); j++) {
+			uint32_t outEdge = out[v][j];
+			uint32_t x = m_edges[outEdge].to;
+			double via = inWeight + m_edges[outEdge].weight;
+			if (x == u || witness.distance(x) <= via)
+				continue;
+			shortcuts++;
+			if (apply) {
+				Edge shortcut = { u, x, via, NO_EDGE, inEdge, outEdge };
+				out[u].push_back((uint32_t)m_edges.size());
+				in[x].push_back((uint32_t)m_edges.size());
+				m_edges.push_back(shortcut);
+				m_numShortcuts++;
+			}
+		}
+	}
+	return shortcuts;
+}
+
+bool ContractionHierarchy::search(NodeId start, NodeId end, vector<uint32_t>& edges, double& distance, RouteStats* stats) const
+{
+	SearchSpace& forward = threadSearchSpace(0);
+	SearchSpace& backward = threadSearchSpace(1);
+	forward.begin(m_numNodes);
+	backward.begin(m_numNodes);
+	forward.reach(start, 0, NO_NODE, NO_EDGE);
+	forward.heap.pushOrDecrease(start, 0);
+	backward.reach(end, 0, NO_NODE, NO_EDGE);
+	backward.heap.pushOrDecrease(end, 0);
+
+	double best = numeric_limits<double>::infinity();
+	NodeId meeting = NO_NODE;
+	if (start == end) {
+		best = 0;
+		meeting = start;
+	}
+
+	for (;;) {
+		// A direction is done once nothing left in it can beat the best meeting
+		bool forwardOpen = !forward.heap.empty() && forward.heap.topKey() < best;
+		bool backwardOpen = !backward.heap.empty() && backward.heap.topKey() < best;
+		if (!forwardOpen && !backwardOpen)
+			break;
+		bool isForward = forwardOpen && (!backwardOpen || forward.heap.topKey() <= backward.heap.topKey());
+		SearchSpace& space = isForward ? forward : backward;
+		SearchSpace& other = isForward ? backward : forward;
+		NodeId cur = space.heap.pop();
+		space.settle(cur);
+		if (stats != nullptr)
+			stats->nodesSettled++;
+
+		// Both searches only climb, so the upward edges out of (or into) cur are all that matter
+		double curDistance = space.distance(cur);
+		const vector<uint32_t>& offsets = isForward ? m_upOutOffsets : m_upInOffsets;
+		const vector<uint32_t>& list = isForward ? m_upOut : m_upIn;
+		for (uint32_t i = offsets[cur]; i < offsets[cur + 1]; i++) {
+			const Edge& e = m_edges[list[i]];
+			NodeId neighbor = isForward ? e.to : e.from;
+			double tentative = curDistance + e.weight;
+			if (tentative < space.distance(neighbor)) {
+				space.reach(neighbor, tentative, cur, list[i]);
+				space.heap.pushOrDecrease(neighbor, tentative);
+				if (other.reached(neighbor) && tentative + other.distance(neighbor) < best) {
+					best = tentative + other.distance(neighbor);
+					meeting = neighbor;
+				}
+			}
+		}
+	}
+	if (meeting == NO_NODE)
+		return false;
+
+	// Collects the hierarchy edges from start to meeting to end, then expands the shortcuts
+	vector<uint32_t> path;
+	for (NodeId n = meeting; n != start; n = forward.parent(n))
+		path.push_back(forward.parentEdge(n));
+	reverse(path.begin(), path.end());
+	for (NodeId n = meeting; n != end; n = backward.parent(n))
+		path.push_back(backward.parentEdge(n));
+	edges.clear();
+	for (size_t i = 0; i < path.size(); i++)
+		unpack(path[i], edges);
+	distance = best;
+	return true;
+}
+
+void ContractionHierarchy::unpack(uint32_t edge, vector<uint32_t>& edges) const
+{
+	// A shortcut's first half has to come out first, so push the second half underneath it
+	vector<uint32_t> pending(1, edge);
+	while (!pending.empty()) {
+		const Edge& e = m_edges[pending.back()];
+		pending.pop_back();
+		if (e.original != NO_EDGE)
+			edges.push_back(e.original);
+		else {
+			pending.push_back(e.child2);
+			pending.push_back(e.child1);
+		}
+	}
+}
@@ -0,0 +1,58 @@
+// ContractionHierarchy.h
+
+// Contraction Hierarchies over a StreetGraph.  Preprocessing contracts the nodes one at
+// a time, least important first, adding a shortcut edge wherever removing a node would
+// lengthen a shortest path.  A query is then a bidirectional Dijkstra that only ever
+// climbs to more important nodes, which settles a few hundred nodes at most.
+#ifndef CONTRACTIONHIERARCHY_H
+#define CONTRACTIONHIERARCHY_H
+
+#include "provided.h"
+#include "RouteSearch.h"
+#include "StreetGraph.h"
+#include <cstdint>
+#include <vector>
+
+class ContractionHierarchy
+{
+public:
+	ContractionHierarchy();
+	void build(const StreetGraph& g);
+
+	// Finds a shortest path from start to end, putting the ids of the original edges along
+	// it in edges.  Returns false if end can't be reached.
+	bool search(NodeId start, NodeId end, std::vector<uint32_t>& edges, double& distance, RouteStats* stats) const;
+
+	int numShortcuts() const { return m_numShortcuts; }
+private:
+	static const uint32_t NO_EDGE = 0xFFFFFFFF;
+
+	// An original edge, or a shortcut standing for two consecutive edges
+	struct Edge {
+		uint32_t from;
+		uint32_t to;
+		double weight;
+		uint32_t original; // Id in the StreetGraph, or NO_EDGE for a shortcut
+		uint32_t child1; // For a shortcut, the edges from->middle and middle->to
+		uint32_t child2;
+	};
+	std::vector<Edge> m_edges;
+	std::vector<uint32_t> m_rank; // Position of each node in the contraction order
+	uint32_t m_numNodes;
+	int m_numShortcuts;
+
+	// Edges leading to more important nodes: out of each node for the forward search,
+	// into each node for the backward search
+	std::vector<uint32_t> m_upOutOffsets;
+	std::vector<uint32_t> m_upOut;
+	std::vector<uint32_t> m_upInOffsets;
+	std::vector<uint32_t> m_upIn;
+
+	// Appends the original edges behind edge
+	void unpack(uint32_t edge, std::vector<uint32_t>& edges) const;
+	// Counts (and if apply, adds) the shortcuts contracting v needs
+	int contract(uint32_t v, bool apply, std::vector<std::vector<uint32_t>>& out,
+		std::vector<std::vector<uint32_t>>& in, SearchSpace& witness);
+};
+
+#endif
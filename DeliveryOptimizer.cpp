@@ -1,7 +1,263 @@
 #include "provided.h"
+#include "GeoDistance.h"
+#include <algorithm>
+#include <chrono>
 #include <vector>
 using namespace std;
 
+namespace {
+	// Improves a closed tour of points with 2-opt and Or-opt moves.  Only moves that join a
+	// point to one of its nearest neighbors are tried, and a point whose moves have all
+	// failed is skipped (its "don't look" bit is set) until a move changes its tour edges,
+	// so each pass costs close to linear time.
+	class TourImprover
+	{
+	public:
+		// batch holds the same points, for finding each one's neighbors
+		TourImprover(const vector<GeoCoord>& points, const GeoPointBatch& batch);
+		// Applies improving moves until none is left or a budget runs out, and returns the
+		// tour starting with point 0
+		vector<int> improve(const vector<int>& tour, int maxMoves, double maxSeconds);
+	private:
+		static const int NUM_NEIGHBORS = 8;
+		static const int MAX_SEGMENT = 3; // Longest run of points an Or-opt move relocates
+
+		const vector<GeoCoord>& m_points;
+		vector<vector<int>> m_neighbors; // Each point's nearest other points, nearest first
+		vector<int> m_tour;
+		vector<int> m_position; // Index of each point in m_tour
+		vector<int> m_queue; // Points whose don't look bit is clear
+		vector<char> m_queued;
+
+		double dist(int a, int b) const
+		{
+			return distanceEarthMiles(m_points[a], m_points[b]);
+		}
+		int next(int p) const { return m_tour[(m_position[p] + 1) % m_tour.size()]; }
+		int prev(int p) const { return m_tour[(m_position[p] + m_tour.size() - 1) % m_tour.size()]; }
+		void wake(int p);
+		void reversePath(int from, int to);
+		void reverseSpan(int i, int length);
+		bool tryTwoOpt(int a);
+		bool tryOrOpt(int a);
+		bool tryMoveSegment(int first, int last);
+	};
+
+	const double MIN_GAIN = 1e-10; // Smaller gains are rounding noise and could cycle
+
+	TourImprover::TourImprover(const vector<GeoCoord>& points, const GeoPointBatch& batch)
+		: m_points(points)
+	{
+		int n = (int)points.size();
+		int k = min((int)NUM_NEIGHBORS, n - 1);
+		m_neighbors.resize(n);
+		vector<double> row(n);
+		vector<pair<double, int>> others;
+		for (int p = 0; p < n; p++) {
+			batch.distancesFrom(p, row.data());
+			others.clear();
+			for (int q = 0; q < n; q++)
+				if (q != p)
+					others.push_back(make_pair(row[q], q));
+			partial_sort(others.begin(), others.begin() + k, others.end());
+			for (int i = 0; i < k; i++)
+				m_neighbors[p].push_back(others[i].second);
+		}
+	}
+
+	vector<int> TourImprover::improve(const vector<int>& tour, int maxMoves, double maxSeconds)
+	{
+		m_tour = tour;
+		int n = (int)m_tour.size();
+		m_position.resize(n);
+		for (int i = 0; i < n; i++)
+			m_position[m_tour[i]] = i;
+		m_queue.clear();
+		m_queued.assign(n, 0);
+		for (int i = n - 1; i >= 0; i--)
+			wake(m_tour[i]);
+
+		// Moves need at least two edges that don't touch
+		auto start = chrono::steady_clock::now();
+		int moves = 0, tries = 0;
+		while (n >= 5 && !m_queue.empty() && moves < maxMoves) {
+			if (++tries % 64 == 0 && chrono::duration<double>(chrono::steady_clock::now() - start).count() > maxSeconds)
+				break;
+			int a = m_queue.back();
+			m_queue.pop_back();
+			m_queued[a] = 0;
+			if (tryTwoOpt(a) || tryOrOpt(a))
+				moves++;
+		}
+
+		// Rotates the tour so it starts at point 0
+		vector<int> result;
+		for (int i = 0; i < n; i++)
+			result.push_back(m_tour[(m_position[0] + i) % n]);
+		return result;
+	}
+
+	void TourImprover::wake(int p)
+	{
+		if (!m_queued[p]) {
+			m_queued[p] = 1;
+			m_queue.push_back(p);
+		}
+	}
+
+	void TourImprover::reversePath(int from, int to)
+	{
+		// Reverses the tour from point from forward to point to.  Reversing the rest of the
+		// tour instead gives the same cycle, so this flips whichever part is shorter.
+		int n = (int)m_tour.size();
+		int i = m_position[from], j = m_position[to];
+		int length = (j - i + n) % n + 1;
+		if (2 * length > n) {
+			i = (j + 1) % n;
+			length = n - length;
+		}
+		reverseSpan(i, length);
+	}
+
+	void TourImprover::reverseSpan(int i, int length)
+	{
+		// Reverses length points of the tour from index i, wrapping round the end of the array
+		int n = (int)m_tour.size();
+		int j = (i + length - 1) % n;
+		for (int swaps = length / 2; swaps > 0; swaps--) {
+			swap(m_tour[i], m_tour[j]);
+			m_position[m_tour[i]] = i;
+			m_position[m_tour[j]] = j;
+			i = (i + 1) % n;
+			j = (j + n - 1) % n;
+		}
+	}
+
+	bool TourImprover::tryTwoOpt(int a)
+	{
+		// Replaces a tour edge at a and another edge with two edges, one of them from a to a
+		// near neighbor c.  Only neighbors closer than a's current edge can help.
+		for (int forward = 1; forward >= 0; forward--) {
+			int b = forward ? next(a) : prev(a);
+			double ab = dist(a, b);
+			for (size_t i = 0; i < m_neighbors[a].size(); i++) {
+				int c = m_neighbors[a][i];
+				double ac = dist(a, c);
+				if (ac >= ab)
+					break;
+				int d = forward ? next(c) : prev(c);
+				if (c == b || d == a)
+					continue;
+				double gain = ab + dist(c, d) - ac - dist(b, d);
+				if (gain > MIN_GAIN) {
+					// a b ... c d becomes a c ... b d
+					if (forward)
+						reversePath(b, c);
+					else
+						reversePath(c, b);
+					wake(a);
+					wake(b);
+					wake(c);
+					wake(d);
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	bool TourImprover::tryOrOpt(int a)
+	{
+		// Tries moving each short run of points that starts or ends at a
+		int n = (int)m_tour.size();
+		for (int length = 1; length <= MAX_SEGMENT && length + 2 < n; length++) {
+			int last = a;
+			for (int i = 1; i < length; i++)
+				last = next(last);
+			if (tryMoveSegment(a, last))
+				return true;
+			int first = a;
+			for (int i = 1; i < length; i++)
+				first = prev(first);
+			if (length > 1 && tryMoveSegment(first, a))
+				return true;
+		}
+		return false;
+	}
+
+	bool TourImprover::tryMoveSegment(int first, int last)
+	{
+		// Takes the run first ... last out from between p and q and puts it, either way
+		// round, between c and e, where c is a near neighbor of one of its ends
+		int p = prev(first), q = next(last);
+		double removeGain = dist(p, first) + dist(last, q) - dist(p, q);
+		if (removeGain <= MIN_GAIN)
+			return false;
+		int n = (int)m_tour.size();
+		int firstPos = m_position[first];
+		int length = (m_position[last] - firstPos + n) % n + 1;
+		auto inSegment = [&](int x) { return (m_position[x] - firstPos + n) % n < length; };
+		// Neighbors in the tour once the run is taken out
+		auto after = [&](int x) { return x == p ? q : next(x); };
+
+		for (int end = 0; end < 2; end++) {
+			int near = end == 0 ? first : last;
+			for (size_t i = 0; i < m_neighbors[near].size(); i++) {
+				int c = m_neighbors[near][i];
+				if (dist(near, c) >= removeGain)
+					break;
+				if (inSegment(c))
+					continue;
+				// The gap on either side of c
+				for (int side = 0; side < 2; side++) {
+					int x = side == 0 ? c : (c == q ? p : prev(c));
+					int y = after(x);
+					if (x == p)
+						continue; // That's where the run already is
+					double gap = dist(x, y);
+					double keep = dist(x, first) + dist(last, y) - gap;
+					double flip = dist(x, last) + dist(first, y) - gap;
+					bool reversed = flip < keep;
+					if (removeGain - min(keep, flip) <= MIN_GAIN)
+						continue;
+
+					// The run and the points between it and the gap, on whichever side is
+					// shorter, form one stretch of the tour, which is rotated in place.  The
+					// stretch can wrap round the end of the array, so the rotation is done as
+					// reversals: flipping each part and then the whole swaps the parts, and
+					// leaving the run unflipped puts it in reversed.
+					int qPos = (firstPos + length) % n;
+					int ahead = (m_position[x] - qPos + n) % n + 1; // q ... x
+					int behind = n - length - ahead; // y ... p
+					if (ahead <= behind) {
+						// first ... last q ... x becomes q ... x first ... last
+						if (!reversed)
+							reverseSpan(firstPos, length);
+						reverseSpan(qPos, ahead);
+						reverseSpan(firstPos, length + ahead);
+					}
+					else {
+						// y ... p first ... last becomes first ... last y ... p
+						int yPos = m_position[y];
+						reverseSpan(yPos, behind);
+						if (!reversed)
+							reverseSpan(firstPos, length);
+						reverseSpan(yPos, behind + length);
+					}
+					wake(p);
+					wake(q);
+					wake(first);
+					wake(last);
+					wake(x);
+					wake(y);
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+}
+
 class DeliveryOptimizerImpl
 {
 public:
@@ -12,13 +268,20 @@ public:
 		vector<DeliveryRequest>& deliveries,
 		double& oldCrowDistance,
 		double& newCrowDistance) const;
+	void setImprovementBudget(int maxMoves, double maxSeconds);
 private:
 	const StreetMap* m_streetMap;
+	int m_maxMoves; // Local search budget, in improving moves
+	double m_maxSeconds; // and in time
+
+	double crowDistance(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries) const;
 };
 
 DeliveryOptimizerImpl::DeliveryOptimizerImpl(const StreetMap* sm)
 {
 	m_streetMap = sm;
+	m_maxMoves = 1000000;
+	m_maxSeconds = 1;
 }
 
 DeliveryOptimizerImpl::~DeliveryOptimizerImpl()
@@ -31,49 +294,77 @@ void DeliveryOptimizerImpl::optimizeDeliveryOrder(
 	double& oldCrowDistance,
 	double& newCrowDistance) const
 {
-	// Gets the old crow distance by summing the distances between the DeliveryRequests
-	double totalDistance = 0;
-	for (vector<DeliveryRequest>::iterator itr = deliveries.begin(); itr != deliveries.end() - 1; itr++)
-		totalDistance += distanceEarthMiles(itr->location, (itr + 1)->location);
-	oldCrowDistance = totalDistance;
-	
-	double minDistance = 100000000;
-	double distance;
-	int minIndex;
-	for (int i = 0; i < deliveries.size(); i++) {
-		distance = distanceEarthMiles(depot, deliveries[i].location);
-		if (distance < minDistance) {
-			minDistance = distance;
-			minIndex = i;
-		}
+	// Gets the old crow distance of the trip from the depot through the deliveries and back
+	oldCrowDistance = crowDistance(depot, deliveries);
+	newCrowDistance = oldCrowDistance;
+	if (deliveries.size() < 2)
+		return;
+
+	// Point 0 is the depot, point i is delivery i - 1
+	vector<GeoCoord> points(1, depot);
+	for (size_t i = 0; i < deliveries.size(); i++)
+		points.push_back(deliveries[i].location);
+	int n = (int)points.size();
+
+	// Distances from one point to all the others are worked out together, a row at a time
+	vector<double> latitudes(n), longitudes(n);
+	for (int i = 0; i < n; i++) {
+		latitudes[i] = points[i].latitude;
+		longitudes[i] = points[i].longitude;
 	}
+	GeoPointBatch batch;
+	batch.assign(latitudes.data(), longitudes.data(), n);
+	vector<double> row(n);
 
-	DeliveryRequest temp = deliveries[0];
-	deliveries[0] = deliveries[minIndex];
-	deliveries[minIndex] = temp;
-
-	// Sorts the array using selection sort
-	minDistance = 100000000;
-	for (int i = 0; i < deliveries.size() - 1; i++) {
-		for (int j = i + 1; j < deliveries.size(); j++) {
-			distance = distanceEarthMiles(deliveries[i].location, deliveries[j].location);
-			if (distance < minDistance) {
-				minDistance = distance;
-				minIndex = j;
+	// Builds a tour by always going to the nearest point not yet visited
+	vector<int> tour(n);
+	for (int i = 0; i < n; i++)
+		tour[i] = i;
+	for (int i = 0; i < n - 1; i++) {
+		batch.distancesFrom(tour[i], row.data());
+		int nearest = i + 1;
+		double nearestDistance = row[tour[i + 1]];
+		for (int j = i + 2; j < n; j++) {
+			double distance = row[tour[j]];
+			if (distance < nearestDistance) {
+				nearestDistance = distance;
+				nearest = j;
 			}
 		}
-		DeliveryRequest temp = deliveries[i];
-		deliveries[i] = deliveries[minIndex];
-		deliveries[minIndex] = temp;
-		minDistance = 10000000;
+		swap(tour[i + 1], tour[nearest]);
 	}
-	
-	// Gets the new crow distance by summing the distances between the new DeliveryRequests
-	totalDistance = 0;
-	for (vector<DeliveryRequest>::iterator itr = deliveries.begin(); itr != deliveries.end() - 1; itr++) {
-		totalDistance += distanceEarthMiles(itr->location, (itr + 1)->location);
+
+	// Then shortens it with local search
+	TourImprover improver(points, batch);
+	tour = improver.improve(tour, m_maxMoves, m_maxSeconds);
+
+	vector<DeliveryRequest> optimized;
+	for (int i = 1; i < n; i++)
+		optimized.push_back(deliveries[tour[i] - 1]);
+	double distance = crowDistance(depot, optimized);
+	// Never hands back an order worse than the one given
+	if (distance < oldCrowDistance) {
+		deliveries = optimized;
+		newCrowDistance = distance;
 	}
-	newCrowDistance = totalDistance;
+}
+
+void DeliveryOptimizerImpl::setImprovementBudget(int maxMoves, double maxSeconds)
+{
+	m_maxMoves = maxMoves;
+	m_maxSeconds = maxSeconds;
+}
+
+double DeliveryOptimizerImpl::crowDistance(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries) const
+{
+	// Sums the straight-line distances from the depot, through each delivery in order, back to the depot
+	if (deliveries.empty())
+		return 0;
+	double totalDistance = distanceEarthMiles(depot, deliveries.front().location);
+	for (size_t i = 0; i + 1 < deliveries.size(); i++)
+		totalDistance += distanceEarthMiles(deliveries[i].location, deliveries[i + 1].location);
+	totalDistance += distanceEarthMiles(deliveries.back().location, depot);
+	return totalDistance;
 }
 
 //******************** DeliveryOptimizer functions ****************************
@@ -99,3 +390,8 @@ void DeliveryOptimizer::optimizeDeliveryOrder(
 {
 	return m_impl->optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance);
 }
+
+void DeliveryOptimizer::setImprovementBudget(int maxMoves, double maxSeconds)
+{
+	m_impl->setImprovementBudget(maxMoves, maxSeconds);
+}
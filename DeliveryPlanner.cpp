@@ -1,4 +1,9 @@
 #include "provided.h"
+#include "ConnectedComponents.h"
+#include "StreetGraph.h"
+#include "support.h"
+#include "ThreadPool.h"
+#include <algorithm>
 #include <vector>
 using namespace std;
 
@@ -12,8 +17,10 @@ public:
 		const vector<DeliveryRequest>& deliveries,
 		vector<DeliveryCommand>& commands,
 		double& totalDistanceTravelled) const;
+	void setParallelRouting(bool parallel);
 private:
 	const StreetMap* m_streetMap;
+	bool m_parallelRouting; // Whether the legs are routed on the shared thread pool
 
 	string getDirection(double angle) const; // Gets the geographic direction in string form
 };
@@ -21,6 +28,7 @@ private:
 DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm)
 {
 	m_streetMap = sm;
+	m_parallelRouting = false;
 }
 
 DeliveryPlannerImpl::~DeliveryPlannerImpl()
@@ -33,49 +41,98 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
 	vector<DeliveryCommand>& commands,
 	double& totalDistanceTravelled) const
 {
-	// Create a new vector to store optimized DeliveryRequests
+	totalDistanceTravelled = 0;
+
+	// Orders the deliveries to shorten the run; the stops, legs and commands below all
+	// follow this order
 	double oldCrowDistance, newCrowDistance;
 	DeliveryOptimizer op(m_streetMap);
-	vector<DeliveryRequest> newDeliveries;
-	for (vector<DeliveryRequest>::const_iterator itr = deliveries.begin(); itr != deliveries.end(); itr++)
-		newDeliveries.push_back(*itr);
+	vector<DeliveryRequest> newDeliveries(deliveries);
 	op.optimizeDeliveryOrder(depot, newDeliveries, oldCrowDistance, newCrowDistance);
 
-	// Loop through the deliveries, generating routes between each
+	// Stops that aren't exactly map points start and end their legs at the nearer end of
+	// the street segment nearest them.  The commands run between map points; the way from
+	// the stop to the segment and along it to that end is counted in the distance, once
+	// for the leg arriving at the stop and once for the leg leaving it.
+	int numLegs = (int)newDeliveries.size() + 1;
+	vector<GeoCoord> stops(numLegs); // The depot, then each delivery
+	vector<NodeId> stopIds(numLegs);
+	vector<double> accessDistances(numLegs, 0); // Miles between each stop and its map point
+	const StreetGraph& g = StreetMapInternals::graph(*m_streetMap);
+	for (int i = 0; i < numLegs; i++) {
+		const GeoCoord& stop = i == 0 ? depot : newDeliveries[i - 1].location;
+		NetworkSnap snap;
+		if (m_streetMap->getNodeId(stop, stopIds[i]))
+			stops[i] = stop;
+		else if (m_streetMap->snapToNetwork(stop.latitude, stop.longitude, snap)) {
+			stopIds[i] = snap.node;
+			stops[i] = m_streetMap->getCoord(snap.node);
+			accessDistances[i] = snap.distance + min(snap.fraction, 1 - snap.fraction) * g.edgeLengths[snap.edge];
+		}
+		else
+			return BAD_COORD;
+	}
+
+	// The run is a loop through every stop, so it's possible exactly when all the stops
+	// can reach each other; checks that before routing any leg
+	const ConnectedComponents& components = StreetMapInternals::components(*m_streetMap);
+	for (int i = 1; i < numLegs; i++)
+		if (!components.mutuallyReachable(stopIds[0], stopIds[i]))
+			return NO_ROUTE;
+
+	// Route every leg: depot to first delivery, (ith - 1) delivery to ith delivery, and
+	// last delivery to depot.  The legs don't depend on each other, so they can be routed
+	// on several threads at once; the router only reads the map.  Each route is kept as
+	// edge ids, so nothing is looked up but what the commands need.
 	PointToPointRouter router(m_streetMap);
-	double distance = 0, routeDistance = 0;
-	list<StreetSegment> route;
-	for (int i = 0; i <= deliveries.size(); i++) {
-		if (i == 0) // Depot to first delivery
-			router.generatePointToPointRoute(depot, deliveries[0].location, route, routeDistance);
-		else if (i == deliveries.size()) // Last delivery to depot
-			router.generatePointToPointRoute(deliveries[i - 1].location, depot, route, routeDistance);
-		else // (ith - 1) delivery to ith delivery
-			router.generatePointToPointRoute(deliveries[i - 1].location, deliveries[i].location, route, routeDistance);
-		distance += routeDistance; // Add to distance
+	vector<vector<unsigned int>> routes(numLegs);
+	vector<double> routeDistances(numLegs, 0);
+	vector<DeliveryResult> routeResults(numLegs, DELIVERY_SUCCESS);
+	auto routeLeg = [&](int i) {
+		const GeoCoord& from = stops[i];
+		const GeoCoord& to = stops[i == numLegs - 1 ? 0 : i + 1];
+		routeResults[i] = router.generatePointToPointEdgeRoute(from, to, routes[i], routeDistances[i]);
+	};
+	if (m_parallelRouting)
+		sharedThreadPool().parallelFor(numLegs, routeLeg);
+	else
+		for (int i = 0; i < numLegs; i++)
+			routeLeg(i);
+	for (int i = 0; i < numLegs; i++) // The first leg that failed fails the plan
+		if (routeResults[i] != DELIVERY_SUCCESS)
+			return routeResults[i];
+
+	// Loop through the legs in order, turning each route into commands.  Streets are told
+	// apart by name id, and a name's text is only fetched for a command; directions and turns
+	// come from the bearings stored with each edge.
+	double distance = 0;
+	for (int i = 0; i < numLegs; i++) {
+		const vector<unsigned int>& route = routes[i];
+		distance += accessDistances[i] + routeDistances[i] + accessDistances[i == numLegs - 1 ? 0 : i + 1]; // Add to distance
 
 		// Loop through the route
-		list<StreetSegment>::iterator itr = route.begin();
-		while (itr != route.end()) {
+		size_t next = 0;
+		while (next < route.size()) {
 			double currentDistance = 0;
-			string currentStreet = itr->name, currentDirection = getDirection(angleOfLine(*itr));
-			StreetSegment previous; // Stores previous StreetSegment (for turns)
+			unsigned int currentStreet = g.edgeNames[route[next]];
+			string currentDirection = getDirection(angleOfBearing(g.edgeBearings[route[next]]));
+			double previous = 0; // Stores previous segment's bearing (for turns)
 			// Loop through current street, adding to the current route distance
-			while (itr != route.end() && currentStreet == itr->name) {
-				currentDistance += distanceEarthMiles(itr->start, itr->end);
-				previous = *itr;
-				itr++;
+			while (next < route.size() && currentStreet == g.edgeNames[route[next]]) {
+				currentDistance += g.edgeLengths[route[next]];
+				previous = g.edgeBearings[route[next]];
+				next++;
 			}
 			DeliveryCommand proceed;
-			proceed.initAsProceedCommand(currentDirection, currentStreet, currentDistance);
+			proceed.initAsProceedCommand(currentDirection, g.name(currentStreet), currentDistance);
 			commands.push_back(proceed);
 			
 			// If reach the end of the route, break out of the loop
-			if (itr == route.end())
+			if (next == route.size())
 				break;
 
 			// For a turn, get the angle between the lines, and then create a turn command
-			double turnAngle = angleBetween2Lines(previous, *itr);
+			double turnAngle = angleBetweenBearings(previous, g.edgeBearings[route[next]]);
 			if (turnAngle < 1 || turnAngle > 359)
 				continue;
 			DeliveryCommand turn;
@@ -84,14 +141,14 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
 				turnDirection = "left";
 			else
 				turnDirection = "right";
-			turn.initAsTurnCommand(turnDirection, itr->name);
+			turn.initAsTurnCommand(turnDirection, g.name(g.edgeNames[route[next]]));
 			commands.push_back(turn);
 		}
 
 		// If haven't returned to the depot, create a delivery command
-		if (i != deliveries.size()) {
+		if (i != numLegs - 1) {
 			DeliveryCommand deliver;
-			deliver.initAsDeliverCommand(deliveries[i].item);
+			deliver.initAsDeliverCommand(newDeliveries[i].item);
 			commands.push_back(deliver);
 		}
 	}
@@ -100,6 +157,11 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
 	return DELIVERY_SUCCESS;
 }
 
+void DeliveryPlannerImpl::setParallelRouting(bool parallel)
+{
+	m_parallelRouting = parallel;
+}
+
 string DeliveryPlannerImpl::getDirection(double angle) const {
 	// Returns geographic direction based on angle
 	string direction;
@@ -150,3 +212,8 @@ DeliveryResult DeliveryPlanner::generateDeliveryPlan(
 {
 	return m_impl->generateDeliveryPlan(depot, deliveries, commands, totalDistanceTravelled);
 }
+
+void DeliveryPlanner::setParallelRouting(bool parallel)
+{
+	m_impl->setParallelRouting(parallel);
+}
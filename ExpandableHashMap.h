@@ -1,11 +1,40 @@
 // ExpandableHashMap.h
 
-// Skeleton for the ExpandableHashMap class template.  You must implement the first six
-// member functions.
+// An open-addressing hash map in the style of a Swiss table.  Keys and values sit in one
+// flat array of slots, and a parallel array holds one control byte per slot: whether the
+// slot is empty, erased, or full, and for a full slot 7 bits of its key's hash.  Slots are
+// probed 16 at a time, comparing all 16 control bytes against the hash in one SSE2
+// instruction where available, so a lookup usually touches one control group and the one
+// slot whose key it compares.  Each slot also keeps its key's full hash, which is compared
+// before the keys themselves and reused when the table grows.
+//
+// Growing normally moves every entry at once.  In incremental mode the old table is kept
+// instead, lookups check both, and each associate or erase moves a few more of its slots,
+// so no single call pays for moving the whole map.
+//
+// Each table is one block, its control bytes followed by its slots, from the Allocator
+// policy (see ArenaAllocator.h).  reset() and the destructor release the allocator.
+//
+// The Stats policy (see HashMapStats.h) is told the length of every probe and about every
+// rehash.  By default it ignores them, and the hooks compile away.
 #ifndef EXPANDABLEHASHMAP_H
 #define EXPANDABLEHASHMAP_H
 
-template<typename KeyType, typename ValueType>
+#include "ArenaAllocator.h"
+#include "HashMapStats.h"
+#include <cstdint>
+#include <new>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define EXPANDABLEHASHMAP_SSE2
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+template<typename KeyType, typename ValueType, typename Allocator = HeapAllocator, typename Stats = NoHashMapStats>
 class ExpandableHashMap
 {
 public:
@@ -14,6 +43,41 @@ public:
 	void reset();
 	int size() const;
 	void associate(const KeyType& key, const ValueType& value);
+	void associate(KeyType&& key, ValueType&& value);
+	bool erase(const KeyType& key); // Returns false if key wasn't in the map
+
+	// If key isn't in the map, adds it with a value built in place from args.  Either way,
+	// returns a pointer to key's value and whether it was added, after a single probe.
+	template<typename... Args>
+	std::pair<ValueType*, bool> try_emplace(const KeyType& key, Args&&... args)
+	{
+		return emplace(key, false, std::forward<Args>(args)...);
+	}
+	template<typename... Args>
+	std::pair<ValueType*, bool> try_emplace(KeyType&& key, Args&&... args)
+	{
+		return emplace(std::move(key), false, std::forward<Args>(args)...);
+	}
+	// Like associate, but also returns a pointer to the value and whether key was added
+	template<typename V>
+	std::pair<ValueType*, bool> insert_or_assign(const KeyType& key, V&& value)
+	{
+		return emplace(key, true, std::forward<V>(value));
+	}
+	template<typename V>
+	std::pair<ValueType*, bool> insert_or_assign(KeyType&& key, V&& value)
+	{
+		return emplace(std::move(key), true, std::forward<V>(value));
+	}
+
+	// Grows the table now so it can hold n entries without growing again
+	void reserve(int n);
+	// Turns incremental growth on or off (it's off by default)
+	void setIncrementalRehash(bool incremental);
+
+	// What the Stats policy has recorded, with the table's current shape filled in
+	const Stats& stats() const;
+	void clearStats(); // reset() leaves the counters alone
 
 	// for a map that can't be modified, return a pointer to const ValueType
 	const ValueType* find(const KeyType& key) const;
@@ -24,156 +88,483 @@ public:
 		return const_cast<ValueType*>(const_cast<const ExpandableHashMap*>(this)->find(key));
 	}
 
+	// The same, for callers that already know hash, which must be what hasher(key) returns
+	void associate(const KeyType& key, const ValueType& value, unsigned int hash);
+	// Looks up the key equal (by key == probe) to probe, which can be any type that knows how
+	// to compare itself to a KeyType, so callers needn't build a KeyType just to look one up
+	template<typename Probe>
+	const ValueType* find(const Probe& probe, unsigned int hash) const
+	{
+		const Table* table;
+		int slot = findEntry(probe, hash, table);
+		return slot < 0 ? nullptr : &table->slots[slot].value;
+	}
+	template<typename Probe>
+	ValueType* find(const Probe& probe, unsigned int hash)
+	{
+		return const_cast<ValueType*>(const_cast<const ExpandableHashMap*>(this)->find(probe, hash));
+	}
+
 	// C++11 syntax for preventing copying and assignment
 	ExpandableHashMap(const ExpandableHashMap&) = delete;
 	ExpandableHashMap& operator=(const ExpandableHashMap&) = delete;
 
 private:
-	struct Node {
+	static const int GROUP_SIZE = 16; // Slots whose control bytes are matched at once
+	static const int MIGRATE_SLOTS = 2 * GROUP_SIZE; // Old slots an operation moves in incremental mode
+	static const int8_t EMPTY = -128; // Control byte of a slot that has never been full
+	static const int8_t DELETED = -2; // Control byte of a slot whose key was erased; 0 to 127 means full
+
+	struct Slot {
+		template<typename K, typename... Args>
+		Slot(unsigned int h, K&& k, Args&&... args)
+			: key(std::forward<K>(k)), value(std::forward<Args>(args)...), hash(h)
+		{}
+
 		KeyType key;
 		ValueType value;
-		Node* next;
+		unsigned int hash; // hasher(key)
 	};
-	int m_size; // Number of Nodes in m_buckets
-	int m_numBuckets; // Number of allocated Node pointers in m_buckets
-	double m_maximumLoadFactor; // Maximum load factor allowed before rehashing
-	Node** m_buckets; // Array of pointers to Nodes, each one holding a linked list
+	struct Table {
+		int numSlots; // A power of two, and a multiple of GROUP_SIZE; 0 if there's no table
+		int numDeleted; // Number of erased slots, which still lengthen probes until a rehash
+		int8_t* control; // One control byte per slot, at the start of the table's block
+		Slot* slots; // Raw storage; only the full slots hold constructed keys and values
+	};
+	Allocator m_allocator;
+	mutable Stats m_stats; // Updated by lookups too
+	int m_size; // Number of entries, in both tables
+	double m_maximumLoadFactor; // Maximum load factor, counting erased slots, allowed before rehashing
+	bool m_incremental;
+	Table m_table; // Where new entries go
+	Table m_old; // While growing incrementally, the table being emptied into m_table
+	int m_migrated; // Slots of m_old moved so far
+
+	// Bit i is set for each slot i of the group whose control byte is c
+	static unsigned matchByte(const int8_t* group, int8_t c);
+	// Bit i is set for each slot i of the group that is empty or erased
+	static unsigned matchFree(const int8_t* group);
+	static int countTrailingZeros(unsigned mask); // Index of the lowest set bit
 
-	void rehash(int nNodes); // Rehashes the hasp map with nNodes Nodes
-	void deleteAll(Node** map, int n); // Deletes all dynamically-allocated data in the class
+	// Slot of table holding a key equal to probe, or -1; adds the groups examined to groups
+	template<typename Probe>
+	static int findSlot(const Table& table, const Probe& probe, unsigned int h, int& groups);
+	// The same, checking both tables while growing; sets table to the one it was found in
+	template<typename Probe>
+	int findEntry(const Probe& probe, unsigned int h, const Table*& table) const;
+	// First empty or erased slot of table on the probe sequence for h
+	static int findFreeSlot(const Table& table, unsigned int h);
+	// Slot holding key, setting found, or else the slot of m_table a new entry for it
+	// should go in, growing the table first if it's too full for one more
+	int findOrPrepareInsert(const KeyType& key, unsigned int h, Table*& table, bool& found);
+	// Finds key's slot, adding it with a value built from args if it's missing (or
+	// assigning args to the value if assign is true and it isn't)
+	template<typename K, typename... Args>
+	std::pair<ValueType*, bool> emplace(K&& key, bool assign, Args&&... args);
+	template<typename K, typename... Args>
+	std::pair<ValueType*, bool> emplaceHashed(K&& key, unsigned int h, bool assign, Args&&... args);
+	static void insert(Table& table, Slot& from); // Moves from into a free slot of table
+	static void eraseSlot(Table& table, int slot);
+	static size_t controlBytes(int numSlots); // Control bytes, padded so the slots are aligned
+	Table allocate(int numSlots);
+	void deleteAll(Table& table); // Destroys every entry in table and frees it
+	void grow(int numSlots); // Moves to a table of numSlots slots, now or incrementally
+	void migrate(int numSlots); // Moves up to numSlots more slots out of m_old
 };
 
-template<typename KeyType, typename ValueType>
-ExpandableHashMap<KeyType, ValueType>::ExpandableHashMap(double maximumLoadFactor)
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::ExpandableHashMap(double maximumLoadFactor)
 {
-	m_size = 0; // Default size is 0
-	m_numBuckets = 8; // Default number of allocated Node pointers is 8
-	m_maximumLoadFactor = maximumLoadFactor;
-	m_buckets = new Node * [m_numBuckets];
-	// Sets all the node pointers to a default value of nullptr
-	for (int i = 0; i < m_numBuckets; i++)
-		m_buckets[i] = nullptr;
+	// Probing stops at a group with an empty slot, so the table can never be allowed to fill
+	m_maximumLoadFactor = maximumLoadFactor > 0.875 ? 0.875 : maximumLoadFactor;
+	m_incremental = false;
+	m_size = 0;
+	m_table = allocate(GROUP_SIZE);
+	m_old = allocate(0);
+	m_migrated = 0;
 }
 
-template<typename KeyType, typename ValueType>
-ExpandableHashMap<KeyType, ValueType>::~ExpandableHashMap()
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::~ExpandableHashMap()
 {
-	deleteAll(m_buckets, m_numBuckets);
+	deleteAll(m_table);
+	deleteAll(m_old);
+	m_allocator.release();
 }
 
-template<typename KeyType, typename ValueType>
-void ExpandableHashMap<KeyType, ValueType>::reset()
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+void ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::reset()
 {
-	// Deletes all the nodes, setting everything to the default values
-	deleteAll(m_buckets, m_numBuckets);
-	m_numBuckets = 8;
+	// Deletes all the entries, setting everything to the default values
+	deleteAll(m_table);
+	deleteAll(m_old);
+	m_allocator.release();
 	m_size = 0;
-	m_buckets = new Node * [m_numBuckets];
-	for (int i = 0; i < m_numBuckets; i++)
-		m_buckets[i] = nullptr;
+	m_table = allocate(GROUP_SIZE);
+	m_migrated = 0;
 }
 
-template<typename KeyType, typename ValueType>
-int ExpandableHashMap<KeyType, ValueType>::size() const
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+int ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::size() const
 {
 	return m_size;
 }
 
-template<typename KeyType, typename ValueType>
-void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& value)
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+void ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::associate(const KeyType& key, const ValueType& value)
 {
-	// Gets the value found at key
-	ValueType* val = find(key);
+	emplace(key, true, value);
+}
 
-	// If no key-value pair exists, then add a new one
-	if (val == nullptr) {
-		// If adding a new key-value pair would result in exceeding the maximum load factor,
-		// rehash with twice the number of allocated Node pointers
-		if ((m_size * 1.0 + 1) / m_numBuckets > m_maximumLoadFactor) {
-			rehash(m_numBuckets * 2);
-		}
-		unsigned int hasher(const KeyType & key);
-		unsigned int h = hasher(key);
-		// Hash and adjust the key so it fits into one of the linked lists
-		Node* b = m_buckets[h % m_numBuckets];
-
-		// Either create a new linked list or add to an existing linked list
-		if (b == nullptr) {
-			m_buckets[h % m_numBuckets] = new Node;
-			b = m_buckets[h % m_numBuckets];
-		}
-		else {
-			while (b->next != nullptr)
-				b = b->next;
-			b->next = new Node;
-			b = b->next;
-		}
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+void ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::associate(KeyType&& key, ValueType&& value)
+{
+	emplace(std::move(key), true, std::move(value));
+}
 
-		b->key = key;
-		b->value = value;
-		b->next = nullptr;
-		m_size++;
-	}
-	// If key-value pair already exists, alter the value
-	else
-		*val = value;
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+void ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::associate(const KeyType& key, const ValueType& value, unsigned int h)
+{
+	emplaceHashed(key, h, true, value);
 }
 
-template<typename KeyType, typename ValueType>
-const ValueType* ExpandableHashMap<KeyType, ValueType>::find(const KeyType& key) const
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+template<typename K, typename... Args>
+std::pair<ValueType*, bool> ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::emplace(K&& key, bool assign, Args&&... args)
 {
-	// Gets the bucket, then loops through the linked list to find the key
 	unsigned int hasher(const KeyType & key);
 	unsigned int h = hasher(key);
-	Node* b = m_buckets[h % m_numBuckets];
-	while (b != nullptr) {
-		if (b->key == key)
-			return &b->value;
-		b = b->next;
+	return emplaceHashed(std::forward<K>(key), h, assign, std::forward<Args>(args)...);
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+template<typename K, typename... Args>
+std::pair<ValueType*, bool> ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::emplaceHashed(K&& key, unsigned int h, bool assign, Args&&... args)
+{
+	migrate(MIGRATE_SLOTS);
+
+	// If key-value pair already exists, alter the value if asked to
+	Table* table;
+	bool found;
+	int slot = findOrPrepareInsert(key, h, table, found);
+	if (found) {
+		if (assign)
+			table->slots[slot].value = ValueType(std::forward<Args>(args)...);
+		return std::make_pair(&table->slots[slot].value, false);
 	}
-	// If not found, returns nullptr
-	return nullptr;
+
+	if (m_table.control[slot] == DELETED)
+		m_table.numDeleted--;
+	m_table.control[slot] = int8_t(h & 0x7F);
+	new (&m_table.slots[slot]) Slot(h, std::forward<K>(key), std::forward<Args>(args)...);
+	m_size++;
+	return std::make_pair(&m_table.slots[slot].value, true);
 }
 
-template<typename KeyType, typename ValueType>
-void ExpandableHashMap<KeyType, ValueType>::rehash(int nNodes)
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+int ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::findOrPrepareInsert(const KeyType& key, unsigned int h, Table*& table, bool& found)
 {
-	// Reassigns member variables to new values
-	Node** oldBuckets = m_buckets;
-	int oldNumBuckets = m_numBuckets;
-	m_buckets = new Node * [nNodes];
-	m_numBuckets = nNodes;
-	m_size = 0;
-	// Sets the new Node pointer array's values to nullptr
-	for (int i = 0; i < m_numBuckets; i++)
-		m_buckets[i] = nullptr;
-
-	// Loops through the old array, associating all its values into the new array
-	for (int i = 0; i < oldNumBuckets; i++) {
-		Node* ob = oldBuckets[i];
-		while (ob != nullptr) {
-			associate(ob->key, ob->value);
-			ob = ob->next;
+	// Probes like findSlot, remembering the first free slot it passes, since that's where
+	// the key goes if the probe shows it isn't there
+	int8_t tag = int8_t(h & 0x7F);
+	int groupMask = m_table.numSlots / GROUP_SIZE - 1;
+	int group = (h >> 7) & groupMask;
+	int freeSlot = -1;
+	int groups = 0;
+	table = &m_table;
+	found = true;
+	for (int step = 1; step <= groupMask + 1; step++) {
+		int first = group * GROUP_SIZE;
+		groups++;
+		for (unsigned match = matchByte(m_table.control + first, tag); match != 0; match &= match - 1) {
+			int slot = first + countTrailingZeros(match);
+			if (m_table.slots[slot].hash == h && m_table.slots[slot].key == key) {
+				m_stats.probed(groups);
+				return slot;
+			}
+		}
+		unsigned freeSlots = matchFree(m_table.control + first);
+		if (freeSlot < 0 && freeSlots != 0)
+			freeSlot = first + countTrailingZeros(freeSlots);
+		if (matchByte(m_table.control + first, EMPTY) != 0)
+			break;
+		group = (group + step) & groupMask;
+	}
+	if (m_old.numSlots != 0) {
+		table = &m_old;
+		int slot = findSlot(m_old, key, h, groups);
+		if (slot >= 0) {
+			m_stats.probed(groups);
+			return slot;
 		}
+		table = &m_table;
 	}
+	m_stats.probed(groups);
+	found = false;
 
-	// Deallocates the old array
-	deleteAll(oldBuckets, oldNumBuckets);
+	// If adding a new key-value pair would exceed the maximum load factor, rehash: to twice
+	// the size if the map itself is full, or in place if erased slots make up the difference
+	if ((m_size + m_table.numDeleted + 1.0) / m_table.numSlots > m_maximumLoadFactor) {
+		if ((m_size + 1.0) / m_table.numSlots > m_maximumLoadFactor / 2)
+			grow(m_table.numSlots * 2);
+		else
+			grow(m_table.numSlots);
+		freeSlot = findFreeSlot(m_table, h);
+	}
+	return freeSlot;
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+bool ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::erase(const KeyType& key)
+{
+	migrate(MIGRATE_SLOTS);
+	unsigned int hasher(const KeyType & key);
+	const Table* table;
+	int slot = findEntry(key, hasher(key), table);
+	if (slot < 0)
+		return false;
+	eraseSlot(table == &m_table ? m_table : m_old, slot);
+	m_size--;
+	return true;
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+void ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::reserve(int n)
+{
+	int numSlots = m_table.numSlots;
+	while (n > m_maximumLoadFactor * numSlots)
+		numSlots *= 2;
+	if (numSlots == m_table.numSlots)
+		return;
+	// The caller asked to pay for growing now, so this moves everything at once
+	bool incremental = m_incremental;
+	m_incremental = false;
+	grow(numSlots);
+	m_incremental = incremental;
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+void ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::setIncrementalRehash(bool incremental)
+{
+	m_incremental = incremental;
+	if (!incremental)
+		migrate(m_old.numSlots);
 }
 
-template<typename KeyType, typename ValueType>
-void ExpandableHashMap<KeyType, ValueType>::deleteAll(Node** map, int n)
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+const Stats& ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::stats() const
 {
-	// Loops through the m_buckets array, deallocating all Nodes, and then the whole array
-	for (int i = 0; i < n; i++) {
-		Node* b = map[i];
-		while (b != nullptr) {
-			Node* temp = b->next;
-			delete b;
-			b = temp;
+	size_t bytes = 0;
+	if (m_table.numSlots != 0)
+		bytes += controlBytes(m_table.numSlots) + sizeof(Slot) * m_table.numSlots;
+	if (m_old.numSlots != 0)
+		bytes += controlBytes(m_old.numSlots) + sizeof(Slot) * m_old.numSlots;
+	m_stats.snapshot(m_size, m_table.numSlots, m_table.numDeleted, bytes);
+	return m_stats;
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+void ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::clearStats()
+{
+	m_stats.clear();
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+const ValueType* ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::find(const KeyType& key) const
+{
+	// Gets the slot, then returns its value, if not found, returns nullptr
+	unsigned int hasher(const KeyType & key);
+	return find(key, hasher(key));
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+unsigned ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::matchByte(const int8_t* group, int8_t c)
+{
+#ifdef EXPANDABLEHASHMAP_SSE2
+	__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+	return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+#else
+	unsigned mask = 0;
+	for (int i = 0; i < GROUP_SIZE; i++)
+		if (group[i] == c)
+			mask |= 1u << i;
+	return mask;
+#endif
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+unsigned ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::matchFree(const int8_t* group)
+{
+	// Empty and erased are the control bytes with the sign bit set
+#ifdef EXPANDABLEHASHMAP_SSE2
+	return (unsigned)_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group)));
+#else
+	unsigned mask = 0;
+	for (int i = 0; i < GROUP_SIZE; i++)
+		if (group[i] < 0)
+			mask |= 1u << i;
+	return mask;
+#endif
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+int ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::countTrailingZeros(unsigned mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+template<typename Probe>
+int ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::findSlot(const Table& table, const Probe& probe, unsigned int h, int& groups)
+{
+	// The low 7 bits of the hash go in the control byte, the rest pick the first group.
+	// Groups are probed at triangular offsets, which visit every group of a power-of-two table.
+	int8_t tag = int8_t(h & 0x7F);
+	int groupMask = table.numSlots / GROUP_SIZE - 1;
+	int group = (h >> 7) & groupMask;
+	for (int step = 1; step <= groupMask + 1; step++) {
+		int first = group * GROUP_SIZE;
+		groups++;
+		for (unsigned match = matchByte(table.control + first, tag); match != 0; match &= match - 1) {
+			int slot = first + countTrailingZeros(match);
+			if (table.slots[slot].hash == h && table.slots[slot].key == probe)
+				return slot;
 		}
+		if (matchByte(table.control + first, EMPTY) != 0)
+			return -1;
+		group = (group + step) & groupMask;
+	}
+	return -1;
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+template<typename Probe>
+int ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::findEntry(const Probe& probe, unsigned int h, const Table*& table) const
+{
+	table = &m_table;
+	int groups = 0;
+	int slot = findSlot(m_table, probe, h, groups);
+	if (slot < 0 && m_old.numSlots != 0) {
+		table = &m_old;
+		slot = findSlot(m_old, probe, h, groups);
+	}
+	m_stats.probed(groups);
+	return slot;
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+int ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::findFreeSlot(const Table& table, unsigned int h)
+{
+	int groupMask = table.numSlots / GROUP_SIZE - 1;
+	int group = (h >> 7) & groupMask;
+	for (int step = 1; ; step++) {
+		unsigned match = matchFree(table.control + group * GROUP_SIZE);
+		if (match != 0)
+			return group * GROUP_SIZE + countTrailingZeros(match);
+		group = (group + step) & groupMask;
+	}
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+void ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::insert(Table& table, Slot& from)
+{
+	// The key is known not to be in table, so there's nothing to compare
+	int slot = findFreeSlot(table, from.hash);
+	if (table.control[slot] == DELETED)
+		table.numDeleted--;
+	table.control[slot] = int8_t(from.hash & 0x7F);
+	new (&table.slots[slot]) Slot(from.hash, std::move(from.key), std::move(from.value));
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+void ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::eraseSlot(Table& table, int slot)
+{
+	table.slots[slot].~Slot();
+	// A probe only ever passes a group with no empty slot.  If this group still has one,
+	// no probe has passed it, so the slot can go back to empty instead of leaving a marker.
+	const int8_t* group = table.control + (slot & ~(GROUP_SIZE - 1));
+	if (matchByte(group, EMPTY) != 0)
+		table.control[slot] = EMPTY;
+	else {
+		table.control[slot] = DELETED;
+		table.numDeleted++;
+	}
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+size_t ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::controlBytes(int numSlots)
+{
+	return (numSlots + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot);
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+typename ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::Table ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::allocate(int numSlots)
+{
+	Table table;
+	table.numSlots = numSlots;
+	table.numDeleted = 0;
+	table.control = nullptr;
+	table.slots = nullptr;
+	if (numSlots != 0) {
+		char* block = static_cast<char*>(m_allocator.allocate(controlBytes(numSlots) + sizeof(Slot) * numSlots, alignof(Slot)));
+		table.control = reinterpret_cast<int8_t*>(block);
+		table.slots = reinterpret_cast<Slot*>(block + controlBytes(numSlots));
+		for (int i = 0; i < numSlots; i++)
+			table.control[i] = EMPTY;
+	}
+	return table;
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+void ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::deleteAll(Table& table)
+{
+	// Destroys the entries in the full slots, then frees the block, leaving no table
+	if (table.numSlots == 0)
+		return;
+	for (int i = 0; i < table.numSlots; i++)
+		if (table.control[i] >= 0)
+			table.slots[i].~Slot();
+	m_allocator.deallocate(table.control, controlBytes(table.numSlots) + sizeof(Slot) * table.numSlots);
+	table = allocate(0);
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+void ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::grow(int numSlots)
+{
+	// A growth still under way has to finish before another can start
+	migrate(m_old.numSlots);
+	m_stats.rehashed();
+	m_old = m_table;
+	m_migrated = 0;
+	m_table = allocate(numSlots);
+	if (!m_incremental)
+		migrate(m_old.numSlots);
+}
+
+template<typename KeyType, typename ValueType, typename Allocator, typename Stats>
+void ExpandableHashMap<KeyType, ValueType, Allocator, Stats>::migrate(int numSlots)
+{
+	// Moved slots are marked erased rather than empty, so probes for the keys still in
+	// m_old keep walking past them
+	if (m_old.numSlots == 0)
+		return;
+	typename Stats::Timer timer(m_stats);
+	int end = numSlots < m_old.numSlots - m_migrated ? m_migrated + numSlots : m_old.numSlots;
+	for (; m_migrated < end; m_migrated++) {
+		if (m_old.control[m_migrated] < 0)
+			continue;
+		insert(m_table, m_old.slots[m_migrated]);
+		m_old.slots[m_migrated].~Slot();
+		m_old.control[m_migrated] = DELETED;
 	}
-	delete[] map;
+	if (m_migrated == m_old.numSlots)
+		deleteAll(m_old);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,301 @@
+#include "GeoDistance.h"
+#include "StreetGraph.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GEODISTANCE_SSE2
+#endif
+// The AVX kernel is compiled for AVX on its own, so the rest of the program still runs on
+// processors without it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define GEODISTANCE_AVX
+#define AVX_FUNCTION __attribute__((target("avx")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#define GEODISTANCE_AVX
+#define AVX_FUNCTION
+#endif
+using namespace std;
+
+namespace {
+	const double EARTH_DIAMETER_MILES = 2 * EARTH_RADIUS_MILES;
+
+	// asin(x) = x + x^3 P(x^2) / Q(x^2) for 0 <= x <= 0.625, and
+	// asin(1 - x) = pi/2 - sqrt(2x) (1 + x R(x) / S(x)) above that.  P and Q match asin's
+	// series at eleven Chebyshev points of the range, R and S are the Cephes library's, and
+	// both are within a unit in the last place.  Q and S have a leading coefficient of 1,
+	// which is left out.
+	const double ASIN_SMALL_LIMIT = 0.625;
+	const double ASIN_P[6] = {
+		4.086582639688028303904E-03, -6.053389599199173742861E-01, 5.598472801192642123169E+00,
+		-1.699403362945620088453E+01, 2.069950581075017126409E+01, -8.762054669498221315393E+00
+	};
+	const double ASIN_Q[5] = {
+		-1.504219894685067515638E+01, 7.305802872164993289061E+01, -1.544168903131740933077E+02,
+		1.478545824721457222495E+02, -5.257232801698932433965E+01
+	};
+	const double ASIN_R[5] = {
+		2.967721961301243206100E-3, -5.634242780008963776856E-1, 6.968710824104713396794E0,
+		-2.556901049652824852289E1, 2.853665548261061424989E1
+	};
+	const double ASIN_S[4] = {
+		-2.194779531642920639778E1, 1.470656354026814941758E2, -3.838770957603691357202E2,
+		3.424398657913078477438E2
+	};
+	const double PI_OVER_4 = 7.85398163397448309616E-1;
+	const double PI_OVER_2_LOW_BITS = 6.123233995736765886130E-17; // pi / 2 minus its nearest double
+
+	// Each kernel fills out[0] to out[count - 1] with the distances from (px, py, pz) to the
+	// points of xs, ys and zs; count is a multiple of its lanes
+
+	void distancesScalar(double px, double py, double pz, const double* xs, const double* ys, const double* zs,
+		size_t count, double* out)
+	{
+		for (size_t i = 0; i < count; i++) {
+			double dx = xs[i] - px, dy = ys[i] - py, dz = zs[i] - pz;
+			// Half the chord is the sine of half the angle between the points
+			double a = min(sqrt(dx * dx + dy * dy + dz * dz) * 0.5, 1.0);
+			double angle;
+			if (a > ASIN_SMALL_LIMIT) {
+				double w = 1.0 - a;
+				double r = ((((ASIN_R[0] * w + ASIN_R[1]) * w + ASIN_R[2]) * w + ASIN_R[3]) * w + ASIN_R[4]);
+				double s = ((((w + ASIN_S[0]) * w + ASIN_S[1]) * w + ASIN_S[2]) * w + ASIN_S[3]);
+				double p = w * r / s;
+				double root = sqrt(w + w);
+				angle = ((PI_OVER_4 - root) - (root * p - PI_OVER_2_LOW_BITS)) + PI_OVER_4;
+			}
+			else {
+				double w = a * a;
+				double p = (((((ASIN_P[0] * w + ASIN_P[1]) * w + ASIN_P[2]) * w + ASIN_P[3]) * w + ASIN_P[4]) * w + ASIN_P[5]);
+				double q = (((((w + ASIN_Q[0]) * w + ASIN_Q[1]) * w + ASIN_Q[2]) * w + ASIN_Q[3]) * w + ASIN_Q[4]);
+				angle = a * (w * p / q) + a;
+			}
+			out[i] = EARTH_DIAMETER_MILES * angle;
+		}
+	}
+
+#if defined(GEODISTANCE_SSE2)
+	void distancesSse2(double px, double py, double pz, const double* xs, const double* ys, const double* zs,
+		size_t count, double* out)
+	{
+		const __m128d one = _mm_set1_pd(1.0), half = _mm_set1_pd(0.5), limit = _mm_set1_pd(ASIN_SMALL_LIMIT);
+		const __m128d vx = _mm_set1_pd(px), vy = _mm_set1_pd(py), vz = _mm_set1_pd(pz);
+		for (size_t i = 0; i < count; i += 2) {
+			__m128d dx = _mm_sub_pd(_mm_loadu_pd(xs + i), vx);
+			__m128d dy = _mm_sub_pd(_mm_loadu_pd(ys + i), vy);
+			__m128d dz = _mm_sub_pd(_mm_loadu_pd(zs + i), vz);
+			__m128d squared = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+			__m128d a = _mm_min_pd(_mm_mul_pd(_mm_sqrt_pd(squared), half), one);
+
+			__m128d w = _mm_mul_pd(a, a);
+			__m128d p = _mm_set1_pd(ASIN_P[0]);
+			for (int k = 1; k < 6; k++)
+				p = _mm_add_pd(_mm_mul_pd(p, w), _mm_set1_pd(ASIN_P[k]));
+			__m128d q = _mm_add_pd(w, _mm_set1_pd(ASIN_Q[0]));
+			for (int k = 1; k < 5; k++)
+				q = _mm_add_pd(_mm_mul_pd(q, w), _mm_set1_pd(ASIN_Q[k]));
+			__m128d angle = _mm_add_pd(_mm_mul_pd(a, _mm_div_pd(_mm_mul_pd(w, p), q)), a);
+
+			// Points more than about 5300 miles apart are rare, so the other range is only
+			// worked out when a lane needs it
+			__m128d large = _mm_cmpgt_pd(a, limit);
+			if (_mm_movemask_pd(large) != 0) {
+				w = _mm_sub_pd(one, a);
+				__m128d r = _mm_set1_pd(ASIN_R[0]);
+				for (int k = 1; k < 5; k++)
+					r = _mm_add_pd(_mm_mul_pd(r, w), _mm_set1_pd(ASIN_R[k]));
+				__m128d s = _mm_add_pd(w, _mm_set1_pd(ASIN_S[0]));
+				for (int k = 1; k < 4; k++)
+					s = _mm_add_pd(_mm_mul_pd(s, w), _mm_set1_pd(ASIN_S[k]));
+				p = _mm_div_pd(_mm_mul_pd(w, r), s);
+				__m128d root = _mm_sqrt_pd(_mm_add_pd(w, w));
+				__m128d quarter = _mm_set1_pd(PI_OVER_4);
+				__m128d far = _mm_add_pd(_mm_sub_pd(_mm_sub_pd(quarter, root),
+					_mm_sub_pd(_mm_mul_pd(root, p), _mm_set1_pd(PI_OVER_2_LOW_BITS))), quarter);
+				angle = _mm_or_pd(_mm_and_pd(large, far), _mm_andnot_pd(large, angle));
+			}
+			_mm_storeu_pd(out + i, _mm_mul_pd(_mm_set1_pd(EARTH_DIAMETER_MILES), angle));
+		}
+	}
+#endif
+
+#if defined(GEODISTANCE_AVX)
+	AVX_FUNCTION void distancesAvx(double px, double py, double pz, const double* xs, const double* ys, const double* zs,
+		size_t count, double* out)
+	{
+		const __m256d one = _mm256_set1_pd(1.0), half = _mm256_set1_pd(0.5), limit = _mm256_set1_pd(ASIN_SMALL_LIMIT);
+		const __m256d vx = _mm256_set1_pd(px), vy = _mm256_set1_pd(py), vz = _mm256_set1_pd(pz);
+		for (size_t i = 0; i < count; i += 4) {
+			__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(xs + i), vx);
+			__m256d dy = _mm256_sub_pd(_mm256_loadu_pd(ys + i), vy);
+			__m256d dz = _mm256_sub_pd(_mm256_loadu_pd(zs + i), vz);
+			__m256d squared = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+			__m256d a = _mm256_min_pd(_mm256_mul_pd(_mm256_sqrt_pd(squared), half), one);
+
+			__m256d w = _mm256_mul_pd(a, a);
+			__m256d p = _mm256_set1_pd(ASIN_P[0]);
+			for (int k = 1; k < 6; k++)
+				p = _mm256_add_pd(_mm256_mul_pd(p, w), _mm256_set1_pd(ASIN_P[k]));
+			__m256d q = _mm256_add_pd(w, _mm256_set1_pd(ASIN_Q[0]));
+			for (int k = 1; k < 5; k++)
+				q = _mm256_add_pd(_mm256_mul_pd(q, w), _mm256_set1_pd(ASIN_Q[k]));
+			__m256d angle = _mm256_add_pd(_mm256_mul_pd(a, _mm256_div_pd(_mm256_mul_pd(w, p), q)), a);
+
+			__m256d large = _mm256_cmp_pd(a, limit, _CMP_GT_OQ);
+			if (_mm256_movemask_pd(large) != 0) {
+				w = _mm256_sub_pd(one, a);
+				__m256d r = _mm256_set1_pd(ASIN_R[0]);
+				for (int k = 1; k < 5; k++)
+					r = _mm256_add_pd(_mm256_mul_pd(r, w), _mm256_set1_pd(ASIN_R[k]));
+				__m256d s = _mm256_add_pd(w, _mm256_set1_pd(ASIN_S[0]));
+				for (int k = 1; k < 4; k++)
+					s = _mm256_add_pd(_mm256_mul_pd(s, w), _mm256_set1_pd(ASIN_S[k]));
+				p = _mm256_div_pd(_mm256_mul_pd(w, r), s);
+				__m256d root = _mm256_sqrt_pd(_mm256_add_pd(w, w));
+				__m256d quarter = _mm256_set1_pd(PI_OVER_4);
+				__m256d far = _mm256_add_pd(_mm256_sub_pd(_mm256_sub_pd(quarter, root),
+					_mm256_sub_pd(_mm256_mul_pd(root, p), _mm256_set1_pd(PI_OVER_2_LOW_BITS))), quarter);
+				angle = _mm256_blendv_pd(angle, far, large);
+			}
+			_mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_set1_pd(EARTH_DIAMETER_MILES), angle));
+		}
+	}
+
+	bool processorHasAvx()
+	{
+#if defined(__GNUC__)
+		return __builtin_cpu_supports("avx");
+#else
+		// The processor has to have AVX, and the operating system has to save its registers
+		int info[4];
+		__cpuid(info, 1);
+		if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+			return false;
+		return (_xgetbv(0) & 6) == 6;
+#endif
+	}
+#endif
+}
+
+DistanceKernel bestDistanceKernel()
+{
+	static const DistanceKernel best = distanceKernelSupported(DISTANCE_AVX) ? DISTANCE_AVX :
+		distanceKernelSupported(DISTANCE_SSE2) ? DISTANCE_SSE2 : DISTANCE_SCALAR;
+	return best;
+}
+
+bool distanceKernelSupported(DistanceKernel kernel)
+{
+	switch (kernel) {
+	case DISTANCE_SCALAR:
+		return true;
+	case DISTANCE_SSE2:
+#if defined(GEODISTANCE_SSE2)
+		return true;
+#else
+		return false;
+#endif
+	case DISTANCE_AVX:
+#if defined(GEODISTANCE_AVX)
+		return processorHasAvx();
+#else
+		return false;
+#endif
+	}
+	return false;
+}
+
+const char* distanceKernelName(DistanceKernel kernel)
+{
+	switch (kernel) {
+	case DISTANCE_SCALAR:
+		return "scalar";
+	case DISTANCE_SSE2:
+		return "SSE2";
+	case DISTANCE_AVX:
+		return "AVX";
+	}
+	return "unknown";
+}
+
+GeoPointBatch::GeoPointBatch()
+{
+	m_size = 0;
+	m_kernel = bestDistanceKernel();
+}
+
+void GeoPointBatch::assign(const double* latitudes, const double* longitudes, size_t count)
+{
+	m_size = count;
+	size_t padded = (count + PADDING - 1) / PADDING * PADDING;
+	m_x.assign(padded, 0);
+	m_y.assign(padded, 0);
+	m_z.assign(padded, 0);
+	for (size_t i = 0; i < count; i++) {
+		double lat = deg2rad(latitudes[i]), lon = deg2rad(longitudes[i]);
+		m_x[i] = cos(lat) * cos(lon);
+		m_y[i] = cos(lat) * sin(lon);
+		m_z[i] = sin(lat);
+	}
+}
+
+void GeoPointBatch::distancesFrom(double latitude, double longitude, double* out) const
+{
+	double lat = deg2rad(latitude), lon = deg2rad(longitude);
+	distancesFromPoint(cos(lat) * cos(lon), cos(lat) * sin(lon), sin(lat), out);
+}
+
+void GeoPointBatch::distancesFrom(size_t i, double* out) const
+{
+	distancesFromPoint(m_x[i], m_y[i], m_z[i], out);
+}
+
+void GeoPointBatch::distanceMatrix(double* out) const
+{
+	for (size_t i = 0; i < m_size; i++)
+		distancesFromPoint(m_x[i], m_y[i], m_z[i], out + i * m_size);
+}
+
+bool GeoPointBatch::setKernel(DistanceKernel kernel)
+{
+	if (!distanceKernelSupported(kernel))
+		return false;
+	m_kernel = kernel;
+	return true;
+}
+
+void GeoPointBatch::distancesFromPoint(double x, double y, double z, double* out) const
+{
+	// Whole multiples of PADDING go straight into out, and a partial one at the end goes
+	// through a buffer so the padding points' distances can be dropped
+	size_t whole = m_size / PADDING * PADDING;
+	runKernel(x, y, z, 0, whole, out);
+	if (whole < m_size) {
+		double tail[PADDING];
+		runKernel(x, y, z, whole, PADDING, tail);
+		copy(tail, tail + (m_size - whole), out + whole);
+	}
+}
+
+void GeoPointBatch::runKernel(double x, double y, double z, size_t first, size_t count, double* out) const
+{
+	switch (m_kernel) {
+#if defined(GEODISTANCE_AVX)
+	case DISTANCE_AVX:
+		distancesAvx(x, y, z, m_x.data() + first, m_y.data() + first, m_z.data() + first, count, out);
+		return;
+#endif
+#if defined(GEODISTANCE_SSE2)
+	case DISTANCE_SSE2:
+		distancesSse2(x, y, z, m_x.data() + first, m_y.data() + first, m_z.data() + first, count, out);
+		return;
+#endif
+	default:
+		distancesScalar(x, y, z, m_x.data() + first, m_y.data() + first, m_z.data() + first, count, out);
+		return;
+	}
+}
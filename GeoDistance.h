@@ -0,0 +1,65 @@
+// GeoDistance.h
+
+// Great-circle distances between many points at once, for filling crow-distance tables
+// without calling distanceEarthMiles pair by pair.  The points are given as separate
+// latitude and longitude arrays and turned once into positions on a unit sphere, which
+// is all the trigonometry there is per point.  Each distance after that is the chord
+// between two positions turned into an arc, 2 asin(chord / 2), with asin worked out as a
+// rational polynomial so several distances are found at once in vector registers.
+//
+// The kernel is picked when the program runs: 256-bit AVX where the processor has it,
+// 128-bit SSE2 on any other x86-64 processor, and otherwise one distance at a time.  All
+// of them do the same operations in the same order, so they give the same numbers; each
+// agrees with distanceEarthMiles to within a few billionths of a mile.
+#ifndef GEODISTANCE_H
+#define GEODISTANCE_H
+
+#include <cstddef>
+#include <vector>
+
+enum DistanceKernel
+{
+	DISTANCE_SCALAR, DISTANCE_SSE2, DISTANCE_AVX
+};
+
+// Whether this processor and build can run a kernel, and the fastest one that can run
+DistanceKernel bestDistanceKernel();
+bool distanceKernelSupported(DistanceKernel kernel);
+const char* distanceKernelName(DistanceKernel kernel);
+
+class GeoPointBatch
+{
+public:
+	GeoPointBatch();
+	// Takes count points from latitudes[i] and longitudes[i], in degrees
+	void assign(const double* latitudes, const double* longitudes, size_t count);
+	size_t size() const { return m_size; }
+
+	// Fills out[0] to out[size() - 1] with the distances in miles from a point (in degrees,
+	// or point i of the batch) to every point of the batch
+	void distancesFrom(double latitude, double longitude, double* out) const;
+	void distancesFrom(size_t i, double* out) const;
+	// Fills out[i * size() + j] with the distance from point i to point j
+	void distanceMatrix(double* out) const;
+
+	// Uses the given kernel instead of bestDistanceKernel(), for checking the kernels against
+	// each other.  Returns false, changing nothing, if the kernel can't run here.
+	bool setKernel(DistanceKernel kernel);
+	DistanceKernel kernel() const { return m_kernel; }
+private:
+	static const size_t PADDING = 4; // The widest kernel's lanes; the arrays are a multiple of it long
+
+	size_t m_size;
+	DistanceKernel m_kernel;
+	// Each point's position on a unit sphere, one array per axis, padded with points at the
+	// center so the kernels never need a partial load
+	std::vector<double> m_x;
+	std::vector<double> m_y;
+	std::vector<double> m_z;
+
+	void distancesFromPoint(double x, double y, double z, double* out) const;
+	// Runs the chosen kernel over count points from point first, count being a multiple of PADDING
+	void runKernel(double x, double y, double z, size_t first, size_t count, double* out) const;
+};
+
+#endif
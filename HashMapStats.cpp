@@ -0,0 +1,55 @@
+#include "HashMapStats.h"
+#include <ostream>
+using namespace std;
+
+HashMapStats::HashMapStats()
+{
+	clear();
+	size = 0;
+	numSlots = 0;
+	numDeleted = 0;
+	loadFactor = 0;
+	bytesUsed = 0;
+}
+
+void HashMapStats::clear()
+{
+	for (int i = 0; i < HISTOGRAM_SIZE; i++)
+		probeLengths[i] = 0;
+	probes = 0;
+	maxProbeLength = 0;
+	rehashes = 0;
+	rehashSeconds = 0;
+}
+
+double HashMapStats::averageProbeLength() const
+{
+	if (probes == 0)
+		return 0;
+	double total = 0;
+	for (int i = 0; i < HISTOGRAM_SIZE; i++)
+		total += (i + 1.0) * probeLengths[i];
+	return total / probes;
+}
+
+void HashMapStats::print(ostream& out) const
+{
+	out << "  " << size << " entries in " << numSlots << " slots (" << numDeleted << " erased), load factor "
+		<< loadFactor << ", " << bytesUsed << " bytes" << endl;
+	out << "  " << rehashes << " rehashes taking " << rehashSeconds * 1000 << " ms" << endl;
+	out << "  " << probes << " probes, " << averageProbeLength() << " groups on average, at most " << maxProbeLength << endl;
+	// Only the buckets up to the longest probe; the rest are empty
+	for (int i = 0; i < HISTOGRAM_SIZE && i < maxProbeLength; i++) {
+		out << "    " << i + 1 << (i == HISTOGRAM_SIZE - 1 ? "+" : "") << " group" << (i == 0 ? ": " : "s: ")
+			<< probeLengths[i] << " (" << (probes == 0 ? 0 : 100.0 * probeLengths[i] / probes) << "%)" << endl;
+	}
+}
+
+void HashMapStats::snapshot(int size, int numSlots, int numDeleted, size_t bytes)
+{
+	this->size = size;
+	this->numSlots = numSlots;
+	this->numDeleted = numDeleted;
+	loadFactor = numSlots == 0 ? 0 : (size + numDeleted) / (double)numSlots;
+	bytesUsed = bytes;
+}
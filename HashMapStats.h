@@ -0,0 +1,77 @@
+// HashMapStats.h
+
+// Statistics policies for ExpandableHashMap.  The map calls its policy's hooks after every
+// probe and around every rehash.  NoHashMapStats, the default, does nothing in its hooks,
+// so a map without statistics compiles to the same code as before.
+//
+// HashMapStats records how many groups each probe examined, how often and for how long
+// the table was rehashed, and, each time the map's stats() is asked for, the table's
+// current load factor and memory.  Long probes at a modest load factor mean the hasher is
+// clustering its keys.
+#ifndef HASHMAPSTATS_H
+#define HASHMAPSTATS_H
+
+#include <chrono>
+#include <cstddef>
+#include <iosfwd>
+
+class NoHashMapStats
+{
+public:
+	void probed(int /* groups */) {}
+	void rehashed() {}
+	class Timer {
+	public:
+		explicit Timer(NoHashMapStats&) {}
+	};
+	void snapshot(int /* size */, int /* numSlots */, int /* numDeleted */, size_t /* bytes */) {}
+};
+
+class HashMapStats
+{
+public:
+	static const int HISTOGRAM_SIZE = 16;
+
+	HashMapStats();
+	void clear(); // Zeroes the counters
+
+	// Lookups that examined i + 1 groups of slots before finding the key or an empty
+	// slot; the last bucket also counts every longer probe
+	long long probeLengths[HISTOGRAM_SIZE];
+	long long probes; // Number of lookups, including those made by associate and erase
+	int maxProbeLength; // Most groups any one lookup examined
+	int rehashes; // Times the map moved to a new table, bigger or the same size
+	double rehashSeconds; // Time spent moving entries to new tables
+
+	// The map as of the last call to its stats()
+	int size;
+	int numSlots; // Slots of the current table, not counting one still being emptied
+	int numDeleted; // Erased slots still lengthening probes
+	double loadFactor; // (size + numDeleted) / numSlots, as checked against the maximum
+	size_t bytesUsed; // The tables' own memory, not memory the keys and values point to
+
+	double averageProbeLength() const;
+	void print(std::ostream& out) const;
+
+	// Called by ExpandableHashMap
+	void probed(int groups)
+	{
+		probes++;
+		probeLengths[groups < HISTOGRAM_SIZE ? groups - 1 : HISTOGRAM_SIZE - 1]++;
+		if (groups > maxProbeLength)
+			maxProbeLength = groups;
+	}
+	void rehashed() { rehashes++; }
+	// Adds the time from its construction to its destruction to rehashSeconds
+	class Timer {
+	public:
+		explicit Timer(HashMapStats& stats) : m_stats(stats), m_start(std::chrono::steady_clock::now()) {}
+		~Timer() { m_stats.rehashSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count(); }
+	private:
+		HashMapStats& m_stats;
+		std::chrono::steady_clock::time_point m_start;
+	};
+	void snapshot(int size, int numSlots, int numDeleted, size_t bytes);
+};
+
+#endif
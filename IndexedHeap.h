@@ -0,0 +1,115 @@
+// IndexedHeap.h
+
+// A D-ary min-heap of integer items (node ids) that knows where each item sits,
+// so an item's key can be lowered in place instead of pushing a duplicate.
+#ifndef INDEXEDHEAP_H
+#define INDEXEDHEAP_H
+
+#include <cstdint>
+#include <vector>
+
+template<int D = 4>
+class IndexedHeap
+{
+public:
+	// Makes room for items 0 to numItems - 1
+	void resize(uint32_t numItems)
+	{
+		if (m_position.size() < numItems)
+			m_position.resize(numItems, uint32_t(NOT_IN_HEAP));
+	}
+
+	bool empty() const { return m_heap.empty(); }
+	int size() const { return (int)m_heap.size(); }
+	bool contains(uint32_t item) const { return m_position[item] != NOT_IN_HEAP; }
+	uint32_t top() const { return m_heap[0].item; }
+	double topKey() const { return m_heap[0].key; }
+
+	// Empties the heap, touching only the items still in it
+	void clear()
+	{
+		for (size_t i = 0; i < m_heap.size(); i++)
+			m_position[m_heap[i].item] = NOT_IN_HEAP;
+		m_heap.clear();
+	}
+
+	// Adds item with key, or lowers its key if it's already in the heap with a larger one
+	void pushOrDecrease(uint32_t item, double key)
+	{
+		uint32_t pos = m_position[item];
+		if (pos == NOT_IN_HEAP) {
+			m_heap.push_back(Entry{ key, item });
+			siftUp((uint32_t)m_heap.size() - 1);
+		}
+		else if (key < m_heap[pos].key) {
+			m_heap[pos].key = key;
+			siftUp(pos);
+		}
+	}
+
+	// Removes and returns the item with the smallest key
+	uint32_t pop()
+	{
+		uint32_t item = m_heap[0].item;
+		m_position[item] = NOT_IN_HEAP;
+		Entry last = m_heap.back();
+		m_heap.pop_back();
+		if (!m_heap.empty()) {
+			m_heap[0] = last;
+			m_position[last.item] = 0;
+			siftDown(0);
+		}
+		return item;
+	}
+
+private:
+	static const uint32_t NOT_IN_HEAP = 0xFFFFFFFF;
+
+	struct Entry {
+		double key;
+		uint32_t item;
+	};
+	std::vector<Entry> m_heap; // The heap itself, children of i are D * i + 1 to D * i + D
+	std::vector<uint32_t> m_position; // Index of each item in m_heap, or NOT_IN_HEAP
+
+	void siftUp(uint32_t pos)
+	{
+		Entry e = m_heap[pos];
+		while (pos > 0) {
+			uint32_t parent = (pos - 1) / D;
+			if (!(e.key < m_heap[parent].key))
+				break;
+			m_heap[pos] = m_heap[parent];
+			m_position[m_heap[pos].item] = pos;
+			pos = parent;
+		}
+		m_heap[pos] = e;
+		m_position[e.item] = pos;
+	}
+
+	void siftDown(uint32_t pos)
+	{
+		Entry e = m_heap[pos];
+		uint32_t n = (uint32_t)m_heap.size();
+		for (;;) {
+			// Finds the smallest child
+			uint32_t first = D * pos + 1;
+			if (first >= n)
+				break;
+			uint32_t last = first + D < n ? first + D : n;
+			uint32_t best = first;
+			for (uint32_t c = first + 1; c < last; c++)
+				if (m_heap[c].key < m_heap[best].key)
+					best = c;
+			if (!(m_heap[best].key < e.key))
+				break;
+			m_heap[pos] = m_heap[best];
+			m_position[m_heap[pos].item] = pos;
+			pos = best;
+		}
+		m_heap[pos] = e;
+		m_position[e.item] = pos;
+	}
+};
+
+#endif
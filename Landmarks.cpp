@@ -0,0 +1,93 @@
+#include "Landmarks.h"
+#include "RouteSearch.h"
+#include <algorithm>
+#include <limits>
+using namespace std;
+
+Landmarks::Landmarks()
+{
+	m_numLandmarks = 0;
+}
+
+void Landmarks::build(const StreetGraph& g, int numLandmarks)
+{
+	const double INF = numeric_limits<double>::infinity();
+	m_landmarks.clear();
+	m_numLandmarks = 0;
+	if (g.numNodes == 0)
+		return;
+	numLandmarks = min<int>(numLandmarks, g.numNodes);
+	m_from.assign((size_t)g.numNodes * numLandmarks, INF);
+	m_to.assign((size_t)g.numNodes * numLandmarks, INF);
+
+	// Farthest-point selection: each landmark is the point farthest from all the ones
+	// chosen so far, starting with the point farthest from point 0.  Points the chosen
+	// landmarks can't reach are left out, so landmarks stay on the main street network.
+	vector<double> from, to;
+	vector<double> nearest(g.numNodes, INF); // Distance from the closest landmark so far
+	shortestDistances(g, 0, false, from);
+	for (int i = 0; i < numLandmarks; i++) {
+		NodeId farthest = NO_NODE;
+		double farthestDistance = -1;
+		for (NodeId n = 0; n < g.numNodes; n++) {
+			double d = i == 0 ? from[n] : nearest[n];
+			if (d != INF && d > farthestDistance) {
+				farthest = n;
+				farthestDistance = d;
+			}
+		}
+		// Every reachable point is already a landmark
+		if (farthest == NO_NODE || farthestDistance == 0)
+			break;
+
+		int slot = m_numLandmarks;
+		shortestDistances(g, farthest, false, from);
+		shortestDistances(g, farthest, true, to);
+		for (NodeId n = 0; n < g.numNodes; n++) {
+			m_from[(size_t)n * numLandmarks + slot] = from[n];
+			m_to[(size_t)n * numLandmarks + slot] = to[n];
+			nearest[n] = min(nearest[n], from[n]);
+		}
+		m_landmarks.push_back(farthest);
+		m_numLandmarks++;
+	}
+
+	// Packs the tables down if fewer landmarks were found than asked for
+	if (m_numLandmarks < numLandmarks) {
+		for (size_t n = 0; n < g.numNodes; n++)
+			for (int i = 0; i < m_numLandmarks; i++) {
+				m_from[n * m_numLandmarks + i] = m_from[n * numLandmarks + i];
+				m_to[n * m_numLandmarks + i] = m_to[n * numLandmarks + i];
+			}
+		m_from.resize((size_t)g.numNodes * m_numLandmarks);
+		m_to.resize((size_t)g.numNodes * m_numLandmarks);
+	}
+}
+
+LandmarkTarget::LandmarkTarget(const Landmarks& landmarks, NodeId target)
+	: m_landmarks(landmarks)
+{
+	for (int i = 0; i < landmarks.numLandmarks(); i++) {
+		m_fromLandmark.push_back(landmarks.fromLandmark(target, i));
+		m_toLandmark.push_back(landmarks.toLandmark(target, i));
+	}
+}
+
+double LandmarkTarget::lowerBound(NodeId n) const
+{
+	const double INF = numeric_limits<double>::infinity();
+	double bound = 0;
+	for (int i = 0; i < m_landmarks.numLandmarks(); i++) {
+		double fromN = m_landmarks.fromLandmark(n, i);
+		double toN = m_landmarks.toLandmark(n, i);
+		// If L reaches n but not the target, or the target reaches L but n doesn't, then
+		// n can't reach the target either
+		if ((fromN != INF && m_fromLandmark[i] == INF) || (toN == INF && m_toLandmark[i] != INF))
+			return INF;
+		if (fromN != INF)
+			bound = max(bound, m_fromLandmark[i] - fromN);
+		if (m_toLandmark[i] != INF)
+			bound = max(bound, toN - m_toLandmark[i]);
+	}
+	return bound;
+}
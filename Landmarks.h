@@ -0,0 +1,47 @@
+// Landmarks.h
+
+// Landmark (ALT) lower bounds for A*.  Preprocessing picks a few landmark points spread
+// around the edge of the map and stores every point's shortest distance to and from each
+// of them.  By the triangle inequality, for any landmark L the distance from v to t is at
+// least d(L, t) - d(L, v) and at least d(v, L) - d(t, L), which on a street grid is usually
+// much closer to the truth than the straight line.
+#ifndef LANDMARKS_H
+#define LANDMARKS_H
+
+#include "provided.h"
+#include "StreetGraph.h"
+#include <vector>
+
+class Landmarks
+{
+public:
+	Landmarks();
+	void build(const StreetGraph& g, int numLandmarks = 16);
+
+	int numLandmarks() const { return m_numLandmarks; }
+	NodeId landmark(int i) const { return m_landmarks[i]; }
+	// Shortest distance from landmark i to n and from n to landmark i; infinity if there's no path
+	double fromLandmark(NodeId n, int i) const { return m_from[(size_t)n * m_numLandmarks + i]; }
+	double toLandmark(NodeId n, int i) const { return m_to[(size_t)n * m_numLandmarks + i]; }
+private:
+	int m_numLandmarks;
+	std::vector<NodeId> m_landmarks;
+	// Indexed by node, then landmark, so one node's distances sit together
+	std::vector<double> m_from;
+	std::vector<double> m_to;
+};
+
+// The landmark distances of one search's destination, for bounding the distance left to it
+class LandmarkTarget
+{
+public:
+	LandmarkTarget(const Landmarks& landmarks, NodeId target);
+	// A lower bound on the distance from n to the target, or infinity if n can't reach it
+	double lowerBound(NodeId n) const;
+private:
+	const Landmarks& m_landmarks;
+	std::vector<double> m_fromLandmark; // d(L, target) for each landmark L
+	std::vector<double> m_toLandmark; // d(target, L) for each landmark L
+};
+
+#endif
@@ -0,0 +1,274 @@
+#include "MapFile.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+namespace {
+	uint64_t fnv1a64(const char* data, uint64_t n)
+	{
+		uint64_t h = 14695981039346656037ull;
+		for (uint64_t i = 0; i < n; i++)
+			h = (h ^ (unsigned char)data[i]) * 1099511628211ull;
+		return h;
+	}
+
+	uint64_t align8(uint64_t n)
+	{
+		return (n + 7) & ~(uint64_t)7;
+	}
+
+	// Checks the first and last entries of a mapped graph's offset arrays, which only
+	// touches the pages at either end of each
+	bool checkOffsetBounds(const StreetGraph& g, const MapFileHeader& header)
+	{
+		return g.edgeOffsets[0] == 0 && g.edgeOffsets[g.numNodes] == g.numEdges &&
+			g.reverseOffsets[0] == 0 && g.reverseOffsets[g.numNodes] == g.numEdges &&
+			g.textOffsets[0] == 0 && g.textOffsets[2 * g.numNodes] == header.sectionSize[SECTION_TEXT] &&
+			g.nameOffsets[0] == 0 && g.nameOffsets[g.numNames] == header.sectionSize[SECTION_NAMES];
+	}
+
+	// Checks that every one of a mapped graph's offsets and ids stays inside its array
+	bool checkContents(const StreetGraph& g)
+	{
+		for (uint32_t i = 0; i < g.numNodes; i++)
+			if (g.edgeOffsets[i] > g.edgeOffsets[i + 1] || g.reverseOffsets[i] > g.reverseOffsets[i + 1] ||
+				g.textOffsets[2 * i] > g.textOffsets[2 * i + 1] ||
+				g.textOffsets[2 * i + 1] > g.textOffsets[2 * i + 2])
+				return false;
+		for (uint32_t i = 0; i < g.numNames; i++)
+			if (g.nameOffsets[i] > g.nameOffsets[i + 1])
+				return false;
+		for (uint32_t e = 0; e < g.numEdges; e++)
+			if (g.edgeTargets[e] >= g.numNodes || g.edgeNames[e] >= g.numNames ||
+				g.reverseSources[e] >= g.numNodes || g.reverseEdges[e] >= g.numEdges)
+				return false;
+		// findNode stops at the first empty slot, so there has to be one
+		bool hasEmptySlot = false;
+		for (uint32_t i = 0; i < g.numIndexSlots; i++) {
+			if (g.nodeIndex[i] == NO_NODE)
+				hasEmptySlot = true;
+			else if (g.nodeIndex[i] >= g.numNodes)
+				return false;
+		}
+		return hasEmptySlot;
+	}
+}
+
+bool isMapFile(const string& path)
+{
+	ifstream inFile(path, ios::binary);
+	uint32_t magic = 0;
+	if (!inFile.read(reinterpret_cast<char*>(&magic), sizeof(magic)))
+		return false;
+	return magic == MAP_FILE_MAGIC;
+}
+
+bool writeMapFile(const StreetGraph& graph, const string& path)
+{
+	// The sections, in file order
+	const void* data[NUM_SECTIONS] = {
+		graph.coords, graph.nodePoints, graph.textOffsets, graph.text,
+		graph.edgeOffsets, graph.edgeTargets, graph.edgeNames, graph.edgeLengths, graph.edgeBearings,
+		graph.reverseOffsets, graph.reverseSources, graph.reverseEdges,
+		graph.nameOffsets, graph.names, graph.nodeIndex
+	};
+	uint64_t size[NUM_SECTIONS] = {
+		graph.numNodes * sizeof(FixedCoord), 3 * (uint64_t)graph.numNodes * sizeof(double),
+		(2 * (uint64_t)graph.numNodes + 1) * sizeof(uint32_t), graph.textOffsets[2 * graph.numNodes],
+		((uint64_t)graph.numNodes + 1) * sizeof(uint32_t), graph.numEdges * sizeof(uint32_t), graph.numEdges * sizeof(uint32_t),
+		graph.numEdges * sizeof(double), graph.numEdges * sizeof(double),
+		((uint64_t)graph.numNodes + 1) * sizeof(uint32_t), graph.numEdges * sizeof(uint32_t), graph.numEdges * sizeof(uint32_t),
+		((uint64_t)graph.numNames + 1) * sizeof(uint32_t), graph.nameOffsets[graph.numNames],
+		graph.numIndexSlots * sizeof(uint32_t)
+	};
+
+	MapFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MAP_FILE_MAGIC;
+	header.version = MAP_FILE_VERSION;
+	header.numNodes = graph.numNodes;
+	header.numEdges = graph.numEdges;
+	header.numNames = graph.numNames;
+	header.numIndexSlots = graph.numIndexSlots;
+	header.exactCoords = graph.exactCoords ? 1 : 0;
+
+	// Lays the sections out in one buffer so the checksum can be computed before writing
+	uint64_t offset = align8(sizeof(MapFileHeader));
+	for (int i = 0; i < NUM_SECTIONS; i++) {
+		header.sectionOffset[i] = offset;
+		header.sectionSize[i] = size[i];
+		offset = align8(offset + size[i]);
+	}
+	header.fileSize = offset;
+	vector<char> body(offset - sizeof(MapFileHeader), 0);
+	for (int i = 0; i < NUM_SECTIONS; i++)
+		if (size[i] != 0)
+			memcpy(&body[header.sectionOffset[i] - sizeof(MapFileHeader)], data[i], size[i]);
+	header.checksum = fnv1a64(body.data(), body.size());
+
+	ofstream outFile(path, ios::binary | ios::trunc);
+	if (!outFile) {
+		cerr << "Unable to create file " << path << endl;
+		return false;
+	}
+	outFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	outFile.write(body.data(), body.size());
+	return (bool)outFile;
+}
+
+MappedMapFile::MappedMapFile()
+	: m_data(nullptr), m_size(0), m_fileHandle(nullptr), m_mappingHandle(nullptr)
+{
+}
+
+MappedMapFile::~MappedMapFile()
+{
+	close();
+}
+
+bool MappedMapFile::open(const string& path, bool verify)
+{
+	close();
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		return false;
+	}
+	const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	m_fileHandle = file;
+	m_mappingHandle = mapping;
+	m_data = static_cast<const char*>(view);
+	m_size = (uint64_t)fileSize.QuadPart;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	// The mapping stays valid after the descriptor is closed
+	::close(fd);
+	if (view == MAP_FAILED)
+		return false;
+	m_data = static_cast<const char*>(view);
+	m_size = (uint64_t)st.st_size;
+#endif
+	if (!validate(verify)) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedMapFile::close()
+{
+	if (m_data != nullptr) {
+#if defined(_WIN32)
+		UnmapViewOfFile(m_data);
+		CloseHandle(static_cast<HANDLE>(m_mappingHandle));
+		CloseHandle(static_cast<HANDLE>(m_fileHandle));
+#else
+		munmap(const_cast<char*>(m_data), (size_t)m_size);
+#endif
+	}
+	m_data = nullptr;
+	m_size = 0;
+	m_fileHandle = nullptr;
+	m_mappingHandle = nullptr;
+	m_graph = StreetGraph();
+}
+
+bool MappedMapFile::validate(bool verify)
+{
+	if (m_size < sizeof(MapFileHeader))
+		return false;
+	MapFileHeader header;
+	memcpy(&header, m_data, sizeof(header));
+	if (header.magic != MAP_FILE_MAGIC || header.version != MAP_FILE_VERSION || header.fileSize != m_size) {
+		cerr << "Map file has the wrong format or version" << endl;
+		return false;
+	}
+	if (verify && fnv1a64(m_data + sizeof(MapFileHeader), m_size - sizeof(MapFileHeader)) != header.checksum) {
+		cerr << "Map file checksum mismatch" << endl;
+		return false;
+	}
+
+	// Every section must lie inside the file and be aligned for its element type
+	uint64_t expected[NUM_SECTIONS] = {
+		header.numNodes * sizeof(FixedCoord), 3 * (uint64_t)header.numNodes * sizeof(double),
+		(2 * (uint64_t)header.numNodes + 1) * sizeof(uint32_t), header.sectionSize[SECTION_TEXT],
+		((uint64_t)header.numNodes + 1) * sizeof(uint32_t), header.numEdges * sizeof(uint32_t), header.numEdges * sizeof(uint32_t),
+		header.numEdges * sizeof(double), header.numEdges * sizeof(double),
+		((uint64_t)header.numNodes + 1) * sizeof(uint32_t), header.numEdges * sizeof(uint32_t), header.numEdges * sizeof(uint32_t),
+		((uint64_t)header.numNames + 1) * sizeof(uint32_t), header.sectionSize[SECTION_NAMES],
+		header.numIndexSlots * sizeof(uint32_t)
+	};
+	for (int i = 0; i < NUM_SECTIONS; i++) {
+		if (header.sectionSize[i] != expected[i] || header.sectionOffset[i] % 8 != 0 ||
+			header.sectionOffset[i] + header.sectionSize[i] > m_size) {
+			cerr << "Map file is corrupt" << endl;
+			return false;
+		}
+	}
+	if (header.numIndexSlots == 0 || (header.numIndexSlots & (header.numIndexSlots - 1)) != 0) {
+		cerr << "Map file is corrupt" << endl;
+		return false;
+	}
+
+	m_graph.numNodes = header.numNodes;
+	m_graph.numEdges = header.numEdges;
+	m_graph.numNames = header.numNames;
+	m_graph.numIndexSlots = header.numIndexSlots;
+	m_graph.exactCoords = header.exactCoords != 0;
+	m_graph.coords = reinterpret_cast<const FixedCoord*>(m_data + header.sectionOffset[SECTION_COORDS]);
+	m_graph.nodePoints = reinterpret_cast<const double*>(m_data + header.sectionOffset[SECTION_NODE_POINTS]);
+	m_graph.textOffsets = reinterpret_cast<const uint32_t*>(m_data + header.sectionOffset[SECTION_TEXT_OFFSETS]);
+	m_graph.text = m_data + header.sectionOffset[SECTION_TEXT];
+	m_graph.edgeOffsets = reinterpret_cast<const uint32_t*>(m_data + header.sectionOffset[SECTION_EDGE_OFFSETS]);
+	m_graph.edgeTargets = reinterpret_cast<const uint32_t*>(m_data + header.sectionOffset[SECTION_EDGE_TARGETS]);
+	m_graph.edgeNames = reinterpret_cast<const uint32_t*>(m_data + header.sectionOffset[SECTION_EDGE_NAMES]);
+	m_graph.edgeLengths = reinterpret_cast<const double*>(m_data + header.sectionOffset[SECTION_EDGE_LENGTHS]);
+	m_graph.edgeBearings = reinterpret_cast<const double*>(m_data + header.sectionOffset[SECTION_EDGE_BEARINGS]);
+	m_graph.reverseOffsets = reinterpret_cast<const uint32_t*>(m_data + header.sectionOffset[SECTION_REVERSE_OFFSETS]);
+	m_graph.reverseSources = reinterpret_cast<const uint32_t*>(m_data + header.sectionOffset[SECTION_REVERSE_SOURCES]);
+	m_graph.reverseEdges = reinterpret_cast<const uint32_t*>(m_data + header.sectionOffset[SECTION_REVERSE_EDGES]);
+	m_graph.nameOffsets = reinterpret_cast<const uint32_t*>(m_data + header.sectionOffset[SECTION_NAME_OFFSETS]);
+	m_graph.names = m_data + header.sectionOffset[SECTION_NAMES];
+	m_graph.nodeIndex = reinterpret_cast<const uint32_t*>(m_data + header.sectionOffset[SECTION_NODE_INDEX]);
+
+	// Queries never check the offsets and ids, so they must stay inside their arrays.  A
+	// file from compile() is verified as it's written; a plain open only checks the ends of
+	// the offset arrays, leaving the rest of the file unread until it's used.
+	if (!checkOffsetBounds(m_graph, header) || (verify && !checkContents(m_graph))) {
+		cerr << "Map file is corrupt" << endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,69 @@
+// MapFile.h
+
+// Binary map files.  A map file is a header followed by the arrays of a StreetGraph,
+// each section aligned to 8 bytes, so a mapped file can be used as a StreetGraph in
+// place without parsing or copying anything.
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include "StreetGraph.h"
+#include <cstdint>
+#include <string>
+
+const uint32_t MAP_FILE_MAGIC = 0x50414D47; // "GMAP" in little-endian byte order
+const uint32_t MAP_FILE_VERSION = 5; // Bumped whenever the layout below changes
+
+enum MapFileSection
+{
+	SECTION_COORDS, SECTION_NODE_POINTS, SECTION_TEXT_OFFSETS, SECTION_TEXT,
+	SECTION_EDGE_OFFSETS, SECTION_EDGE_TARGETS, SECTION_EDGE_NAMES, SECTION_EDGE_LENGTHS, SECTION_EDGE_BEARINGS,
+	SECTION_REVERSE_OFFSETS, SECTION_REVERSE_SOURCES, SECTION_REVERSE_EDGES,
+	SECTION_NAME_OFFSETS, SECTION_NAMES, SECTION_NODE_INDEX,
+	NUM_SECTIONS
+};
+
+struct MapFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numNodes;
+	uint32_t numEdges;
+	uint32_t numNames;
+	uint32_t numIndexSlots;
+	uint32_t exactCoords; // StreetGraph::exactCoords
+	uint32_t reserved; // Zero; keeps the fields below 8-byte aligned
+	uint64_t fileSize;
+	uint64_t checksum; // FNV-1a over every byte after the header
+	uint64_t sectionOffset[NUM_SECTIONS]; // From the start of the file
+	uint64_t sectionSize[NUM_SECTIONS]; // In bytes
+};
+
+bool isMapFile(const std::string& path); // Checks a file's magic number
+bool writeMapFile(const StreetGraph& graph, const std::string& path);
+
+// A read-only memory mapping of a map file
+class MappedMapFile
+{
+public:
+	MappedMapFile();
+	~MappedMapFile();
+	// Maps the file and checks its header and section layout, filling in graph().  The
+	// contents are trusted so that pages are only read when a query needs them; verify also
+	// checks the checksum and every offset and id, which reads the whole file.
+	bool open(const std::string& path, bool verify = false);
+	void close();
+	const StreetGraph& graph() const { return m_graph; }
+
+	MappedMapFile(const MappedMapFile&) = delete;
+	MappedMapFile& operator=(const MappedMapFile&) = delete;
+private:
+	const char* m_data; // Start of the mapping
+	uint64_t m_size; // Length of the mapping
+	void* m_fileHandle; // Windows only: handles kept open for the mapping's lifetime
+	void* m_mappingHandle;
+	StreetGraph m_graph;
+
+	bool validate(bool verify); // Checks the header and section bounds, then fills m_graph
+};
+
+#endif
@@ -1,11 +1,12 @@
 #include "provided.h"
-#include "ExpandableHashMap.h"
-#include "support.h"
+#include "ConnectedComponents.h"
+#include "ContractionHierarchy.h"
+#include "RouteCache.h"
+#include "RouteSearch.h"
+#include "StreetGraph.h"
+#include "ThreadPool.h"
 #include <list>
-#include <queue>
-#include <map>
-#include <set>
-#include <unordered_set>
+#include <vector>
 using namespace std;
 
 class PointToPointRouterImpl
@@ -17,19 +18,35 @@ public:
 		const GeoCoord& start,
 		const GeoCoord& end,
 		list<StreetSegment>& route,
-		double& totalDistanceTravelled) const;
+		double& totalDistanceTravelled,
+		RouteStats* stats) const;
+	DeliveryResult generatePointToPointEdgeRoute(
+		const GeoCoord& start,
+		const GeoCoord& end,
+		vector<unsigned int>& edges,
+		double& totalDistanceTravelled,
+		RouteStats* stats) const;
+	DeliveryResult generateDistanceMatrix(
+		const vector<GeoCoord>& points,
+		vector<vector<double>>& distances) const;
+	void setAlgorithm(RouteAlgorithm algorithm);
+	void setRouteCacheCapacity(int capacity);
+	RouteCacheStats routeCacheStats() const;
+	void clearRouteCache();
 private:
 	const StreetMap* m_streetMap;
+	RouteAlgorithm m_algorithm; // Which search a_star runs
+	mutable RouteCache m_cache; // Recently found routes, off unless given a capacity
 
-	bool a_star(GeoCoord start, GeoCoord end, list<StreetSegment>& routedPath) const;
-	void getPath(const ExpandableHashMap<GeoCoord, GeoCoord>& closed, GeoCoord start, GeoCoord current, list<StreetSegment>& routedPath) const;
-	double getDistance(const list <StreetSegment>& s) const;
-	bool checkCoord(const GeoCoord& g1, const GeoCoord& g2) const;
+	bool a_star(NodeId start, NodeId end, vector<uint32_t>& edges, RouteStats* stats) const;
+	void getPath(NodeId start, const vector<uint32_t>& edges, list<StreetSegment>& routedPath) const;
+	double getDistance(const vector<uint32_t>& edges) const;
 };
 
 PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm)
 {
 	m_streetMap = sm;
+	m_algorithm = ROUTE_ASTAR;
 }
 
 PointToPointRouterImpl::~PointToPointRouterImpl()
@@ -40,129 +57,134 @@ DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
 	const GeoCoord& start,
 	const GeoCoord& end,
 	list<StreetSegment>& route,
-	double& totalDistanceTravelled) const
+	double& totalDistanceTravelled,
+	RouteStats* stats) const
 {
-	// Clears route and totalDistanceTravelled
+	// Clears route, then finds the edges and turns them into StreetSegments
 	route.clear();
+	vector<unsigned int> edges;
+	DeliveryResult result = generatePointToPointEdgeRoute(start, end, edges, totalDistanceTravelled, stats);
+	if (result == DELIVERY_SUCCESS && !edges.empty()) {
+		NodeId startId;
+		m_streetMap->getNodeId(start, startId);
+		getPath(startId, edges, route);
+	}
+	return result;
+}
+
+DeliveryResult PointToPointRouterImpl::generatePointToPointEdgeRoute(
+	const GeoCoord& start,
+	const GeoCoord& end,
+	vector<unsigned int>& edges,
+	double& totalDistanceTravelled,
+	RouteStats* stats) const
+{
+	// Clears edges and totalDistanceTravelled
+	edges.clear();
 	totalDistanceTravelled = 0;
-	// If can't find the start and end StreetSegments, then return BAD_COORD
-	vector<StreetSegment> segs;
-	if (!(m_streetMap->getSegmentsThatStartWith(start, segs) && m_streetMap->getSegmentsThatStartWith(end, segs)))
+	if (stats != nullptr)
+		*stats = RouteStats();
+	// If can't find the start and end GeoCoords on the map, then return BAD_COORD
+	NodeId startId, endId;
+	if (!(m_streetMap->getNodeId(start, startId) && m_streetMap->getNodeId(end, endId)))
 		return BAD_COORD;
-	if (start == end) {
-		return DELIVERY_SUCCESS;
-	}
-	// If a_star can find a route, return DELIVERY_SUCCESS
-	if (a_star(start, end, route)) {
-		totalDistanceTravelled = getDistance(route);
+	if (startId == endId) {
 		return DELIVERY_SUCCESS;
 	}
-	// Else, return NO_ROUTE
-	return NO_ROUTE;
-}
-
-bool PointToPointRouterImpl::a_star(GeoCoord start, GeoCoord end, list<StreetSegment>& routedPath) const {
-	ExpandableHashMap<GeoCoord, double> gScore; // Stores gScores (cost up to a particular GeoCoord)
-	ExpandableHashMap<GeoCoord, double> fScore; // Stores fScores (cost up to a particular GeoCoord plus a heuristic (Euclidian distance))
-	gScore.associate(start, 0);
-	fScore.associate(start, 0);
-	priority_queue<GeoCoord, vector<GeoCoord>, CompareCoord> pq(&fScore); // Create a priority_queue with the CompareCoord comparator
-	set<GeoCoord> open; // Stores what values are in the priority_queue (because a priority_queue cannot be searched)
-	ExpandableHashMap<GeoCoord, GeoCoord> path; // Stores the path travelled
-
-	// Add the starting GeoCoord to pq and open
-	pq.push(start);
-	open.insert(start);
-
-	// While the pq is not empty
-	GeoCoord previous;
-	while (!pq.empty()) {
-		// Retrieve and pop the first value off the pq
-		GeoCoord cur = pq.top();
-		pq.pop();
-		open.erase(cur);
-
-		// If the current GeoCoord equals the destination, generate a list of StreetSegments and return true
-		if (cur == end) {
-			getPath(path, start, cur, routedPath);
-			return true;
-		}
-
-		// Set previous to the current GeoCoord
-		previous.latitudeText = cur.latitudeText; previous.longitudeText = cur.longitudeText;
-		previous.latitude = stoi(previous.latitudeText); previous.longitude = stoi(previous.longitudeText);
-
-		// Get the neighboring GeoCoords of cur
-		vector<StreetSegment> neighbors;
-		m_streetMap->getSegmentsThatStartWith(cur, neighbors);
-		// Loop through the neighbors
-		for (vector<StreetSegment>::iterator itr = neighbors.begin(); itr != neighbors.end(); itr++) {
-			GeoCoord neighbor = itr->end;
-			// Calculate a potential gScore for the current neighbor
-			double tentative_gScore = *gScore.find(cur) + distanceEarthMiles(cur, neighbor);
-
-			// If a key-value pair doesn't exist yet for neighbor, or the potential gScore is less than the current one,
-			if (gScore.find(neighbor) == nullptr || tentative_gScore < *gScore.find(neighbor)) {
-				// Add neighbor-cur key-value pair to path
-				path.associate(neighbor, cur);
-				// Associate a gScore and fScore for neighbor
-				gScore.associate(neighbor, tentative_gScore);
-				fScore.associate(neighbor, *gScore.find(neighbor) + distanceEarthMiles(cur, end));
-
-				// If neighbor is not in open (and therefore pq), add to both
-				if (open.find(neighbor) == open.end()) {
-					open.insert(neighbor);
-					pq.push(neighbor);
-				}
-			}
-		}
-	}
-	return false;
-}
-
-void PointToPointRouterImpl::getPath(const ExpandableHashMap<GeoCoord, GeoCoord>& closed, GeoCoord start, GeoCoord end, list<StreetSegment>& routedPath) const {
-	GeoCoord cur = end;
-	for (;;) {
-		// Find the GeoCoord that preceeded cur
-		const GeoCoord cameFrom = *closed.find(cur);
-		// Get the GeoCoords that start with cameFrom
-		vector<StreetSegment> currentSegs;
-		m_streetMap->getSegmentsThatStartWith(cameFrom, currentSegs);
-		for (vector<StreetSegment>::iterator itr = currentSegs.begin(); itr != currentSegs.end(); itr++) {
-			// Find the StreetSegment connecting the two GeoCoords, and add it to routedPath
-			if (itr->start == cameFrom && itr->end == cur) {
-				routedPath.push_front(*itr);
-			}
-		}
-		// If reach the end, break out of the loop
-		if (cameFrom == start)
-			break;
-		cur = cameFrom; // Set the current GeoCoord to the last one
-	}
+	// If the map's components rule out any path, return NO_ROUTE without searching
+	if (StreetMapInternals::components(*m_streetMap).unreachable(startId, endId))
+		return NO_ROUTE;
+	// If the route was asked for recently, answer from the cache
+	unsigned int generation = StreetMapInternals::generation(*m_streetMap);
+	bool found;
+	if (m_cache.lookup(generation, startId, endId, edges, totalDistanceTravelled, found))
+		return found ? DELIVERY_SUCCESS : NO_ROUTE;
+	// If a_star can find a route, return DELIVERY_SUCCESS, else NO_ROUTE
+	found = a_star(startId, endId, edges, stats);
+	if (found)
+		totalDistanceTravelled = getDistance(edges);
+	else
+		edges.clear();
+	m_cache.insert(generation, startId, endId, edges, totalDistanceTravelled, found);
+	return found ? DELIVERY_SUCCESS : NO_ROUTE;
 }
 
-double PointToPointRouterImpl::getDistance(const list<StreetSegment>& s) const {
-	list<StreetSegment>::const_iterator itr = s.begin();
+bool PointToPointRouterImpl::a_star(NodeId start, NodeId end, vector<uint32_t>& edges, RouteStats* stats) const {
+	// Searches with this thread's reusable workspace
+	const StreetGraph& g = StreetMapInternals::graph(*m_streetMap);
+	double distance;
+	if (m_algorithm == ROUTE_BIDIRECTIONAL)
+		return bidirectionalSearch(g, start, end, edges, distance, stats);
+	else if (m_algorithm == ROUTE_CONTRACTION_HIERARCHY)
+		return StreetMapInternals::contractionHierarchy(*m_streetMap).search(start, end, edges, distance, stats);
+	else if (m_algorithm == ROUTE_LANDMARKS)
+		return landmarkSearch(g, StreetMapInternals::landmarks(*m_streetMap), start, end, edges, distance, stats);
+	else
+		return aStarSearch(g, start, end, edges, distance, stats);
+}
 
-	// Gets the distance for a list of StreetSegments
-	double distance = 0;
-	while (itr != s.end()) {
-		distance += distanceEarthMiles(itr->start, itr->end);
-		itr++;
-	}
+DeliveryResult PointToPointRouterImpl::generateDistanceMatrix(
+	const vector<GeoCoord>& points,
+	vector<vector<double>>& distances) const
+{
+	distances.clear();
+	vector<NodeId> ids(points.size());
+	for (size_t i = 0; i < points.size(); i++)
+		if (!m_streetMap->getNodeId(points[i], ids[i]))
+			return BAD_COORD;
+
+	// One search per source that stops once it has settled every point, with the sources
+	// spread across threads; each row is written by only one of them
+	distances.resize(points.size());
+	const StreetGraph& g = StreetMapInternals::graph(*m_streetMap);
+	sharedThreadPool().parallelFor((int)points.size(), [&](int i) {
+		oneToManyDistances(g, ids[i], ids, distances[i]);
+	});
+	return DELIVERY_SUCCESS;
+}
 
-	return distance;
+void PointToPointRouterImpl::setAlgorithm(RouteAlgorithm algorithm)
+{
+	// Another algorithm may break ties between equally short routes differently
+	if (algorithm != m_algorithm)
+		m_cache.clear();
+	m_algorithm = algorithm;
 }
 
-bool PointToPointRouterImpl::checkCoord(const GeoCoord& g1, const GeoCoord& g2) const {
-	vector<StreetSegment> segments;
-	m_streetMap->getSegmentsThatStartWith(g1, segments);
-	for (vector<StreetSegment>::iterator itr = segments.begin(); itr != segments.end(); itr++) {
-		if (g2 == itr->end) {
-			return true;
-		}
+void PointToPointRouterImpl::setRouteCacheCapacity(int capacity)
+{
+	m_cache.setCapacity(capacity);
+}
+
+RouteCacheStats PointToPointRouterImpl::routeCacheStats() const
+{
+	return m_cache.stats();
+}
+
+void PointToPointRouterImpl::clearRouteCache()
+{
+	m_cache.clear();
+}
+
+void PointToPointRouterImpl::getPath(NodeId start, const vector<uint32_t>& edges, list<StreetSegment>& routedPath) const {
+	const StreetGraph& g = StreetMapInternals::graph(*m_streetMap);
+	GeoCoord curCoord = g.coord(start);
+	// Each edge starts where the previous one ended
+	for (size_t i = 0; i < edges.size(); i++) {
+		GeoCoord nextCoord = g.coord(g.edgeTargets[edges[i]]);
+		routedPath.push_back(StreetSegment(curCoord, nextCoord, g.name(g.edgeNames[edges[i]])));
+		curCoord = nextCoord;
 	}
-	return false;
+}
+
+double PointToPointRouterImpl::getDistance(const vector<uint32_t>& edges) const {
+	// Adds up the segments in order, so the total is the same as summing distanceEarthMiles
+	// over the route's StreetSegments
+	const StreetGraph& g = StreetMapInternals::graph(*m_streetMap);
+	double distance = 0;
+	for (size_t i = 0; i < edges.size(); i++)
+		distance += g.edgeLengths[edges[i]];
+	return distance;
 }
 
 //******************** PointToPointRouter functions ***************************
@@ -184,7 +206,45 @@ DeliveryResult PointToPointRouter::generatePointToPointRoute(
 	const GeoCoord& start,
 	const GeoCoord& end,
 	list<StreetSegment>& route,
-	double& totalDistanceTravelled) const
+	double& totalDistanceTravelled,
+	RouteStats* stats) const
+{
+	return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled, stats);
+}
+
+DeliveryResult PointToPointRouter::generateDistanceMatrix(
+	const vector<GeoCoord>& points,
+	vector<vector<double>>& distances) const
+{
+	return m_impl->generateDistanceMatrix(points, distances);
+}
+
+DeliveryResult PointToPointRouter::generatePointToPointEdgeRoute(
+	const GeoCoord& start,
+	const GeoCoord& end,
+	vector<unsigned int>& edges,
+	double& totalDistanceTravelled,
+	RouteStats* stats) const
 {
-	return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled);
-}
\ No newline at end of file
+	return m_impl->generatePointToPointEdgeRoute(start, end, edges, totalDistanceTravelled, stats);
+}
+
+void PointToPointRouter::setAlgorithm(RouteAlgorithm algorithm)
+{
+	m_impl->setAlgorithm(algorithm);
+}
+
+void PointToPointRouter::setRouteCacheCapacity(int capacity)
+{
+	m_impl->setRouteCacheCapacity(capacity);
+}
+
+RouteCacheStats PointToPointRouter::routeCacheStats() const
+{
+	return m_impl->routeCacheStats();
+}
+
+void PointToPointRouter::clearRouteCache()
+{
+	m_impl->clearRouteCache();
+}
@@ -0,0 +1,180 @@
+#include "RouteCache.h"
+using namespace std;
+
+unsigned int hasher(const RouteKey& k)
+{
+	// The 64-bit MurmurHash3 finalizer over both ids, as fixedCoordHash mixes a point
+	uint64_t h = ((uint64_t)k.start << 32) | k.end;
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h >> 33;
+	return (unsigned int)h;
+}
+
+RouteCache::RouteCache()
+{
+	m_capacity = 0;
+	m_generation = 0;
+	m_newest = NONE;
+	m_oldest = NONE;
+}
+
+void RouteCache::setCapacity(int capacity)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_capacity = capacity > 0 ? capacity : 0;
+	m_stats.capacity = m_capacity;
+	if (m_capacity == 0) {
+		dropAll();
+		return;
+	}
+	if (m_index.size() <= m_capacity)
+		return;
+
+	// Evicts from the old end, then packs the survivors into the front of the array in
+	// order of use so the array can shrink
+	while ((int)m_index.size() > m_capacity) {
+		int i = m_oldest;
+		unlink(i);
+		m_index.erase(m_entries[i].key);
+		m_stats.evictions++;
+	}
+	vector<Entry> kept;
+	kept.reserve(m_index.size());
+	for (int i = m_oldest; i != NONE; i = m_entries[i].newer)
+		kept.push_back(std::move(m_entries[i]));
+	dropAll();
+	for (size_t i = 0; i < kept.size(); i++) {
+		m_entries.push_back(std::move(kept[i]));
+		m_index.associate(m_entries.back().key, (int)i);
+		pushNewest((int)i);
+	}
+	m_stats.size = m_index.size();
+}
+
+int RouteCache::capacity() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_capacity;
+}
+
+bool RouteCache::lookup(unsigned int generation, NodeId start, NodeId end,
+	vector<uint32_t>& edges, double& distance, bool& found)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (m_capacity == 0)
+		return false;
+	checkGeneration(generation);
+	RouteKey key = { start, end };
+	const int* i = m_index.find(key);
+	if (i == nullptr) {
+		m_stats.misses++;
+		return false;
+	}
+	m_stats.hits++;
+	unlink(*i);
+	pushNewest(*i);
+	const Entry& entry = m_entries[*i];
+	edges.assign(entry.edges.begin(), entry.edges.end());
+	distance = entry.distance;
+	found = entry.found;
+	return true;
+}
+
+void RouteCache::insert(unsigned int generation, NodeId start, NodeId end,
+	const vector<uint32_t>& edges, double distance, bool found)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (m_capacity == 0)
+		return;
+	checkGeneration(generation);
+
+	// Another thread may have searched for the same route since this one missed it
+	RouteKey key = { start, end };
+	int i;
+	const int* existing = m_index.find(key);
+	if (existing != nullptr) {
+		i = *existing;
+		unlink(i);
+	}
+	else if ((int)m_entries.size() < m_capacity) {
+		i = (int)m_entries.size();
+		m_entries.push_back(Entry());
+		m_index.associate(key, i);
+	}
+	else {
+		// Takes over the least recently used entry, keeping its edges' storage
+		i = m_oldest;
+		unlink(i);
+		m_index.erase(m_entries[i].key);
+		m_index.associate(key, i);
+		m_stats.evictions++;
+	}
+	Entry& entry = m_entries[i];
+	entry.key = key;
+	entry.edges.assign(edges.begin(), edges.end());
+	entry.distance = distance;
+	entry.found = found;
+	pushNewest(i);
+	m_stats.size = m_index.size();
+}
+
+void RouteCache::clear()
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (m_index.size() != 0)
+		m_stats.invalidations++;
+	dropAll();
+}
+
+RouteCacheStats RouteCache::stats() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_stats;
+}
+
+void RouteCache::checkGeneration(unsigned int generation)
+{
+	if (generation == m_generation)
+		return;
+	if (m_index.size() != 0)
+		m_stats.invalidations++;
+	dropAll();
+	m_generation = generation;
+}
+
+void RouteCache::dropAll()
+{
+	m_entries.clear();
+	m_index.reset();
+	m_newest = NONE;
+	m_oldest = NONE;
+	m_stats.size = 0;
+}
+
+void RouteCache::unlink(int i)
+{
+	Entry& entry = m_entries[i];
+	if (entry.newer != NONE)
+		m_entries[entry.newer].older = entry.older;
+	else
+		m_newest = entry.older;
+	if (entry.older != NONE)
+		m_entries[entry.older].newer = entry.newer;
+	else
+		m_oldest = entry.newer;
+}
+
+void RouteCache::pushNewest(int i)
+{
+	Entry& entry = m_entries[i];
+	entry.newer = NONE;
+	entry.older = m_newest;
+	if (m_newest != NONE)
+		m_entries[m_newest].newer = i;
+	else
+		m_oldest = i;
+	m_newest = i;
+}
@@ -0,0 +1,81 @@
+// RouteCache.h
+
+// A bounded cache of point-to-point routes, for a router asked for the same legs again
+// and again (between restaurants, the depot and the same few neighborhoods).  Each route
+// is kept as its edge ids and length, keyed by its end points' node ids; a pair with no
+// route is kept too, since finding that out can take a search of the whole map.  When
+// the cache is full the least recently used route makes room.
+//
+// Entries sit in one array, linked in order of use by index, so a hit is a hash lookup and
+// moving one entry to the front, and a new route takes over an evicted one's storage.  One
+// lock guards it all, since a router's searches may run on several threads at once.  Each
+// call names the map generation its node ids belong to (see
+// StreetMapInternals::generation), and the first call for a new generation drops
+// everything cached for the old one.
+#ifndef ROUTECACHE_H
+#define ROUTECACHE_H
+
+#include "provided.h"
+#include "ExpandableHashMap.h"
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// The end points of a cached route
+struct RouteKey
+{
+	NodeId start;
+	NodeId end;
+};
+
+inline bool operator==(const RouteKey& a, const RouteKey& b)
+{
+	return a.start == b.start && a.end == b.end;
+}
+
+class RouteCache
+{
+public:
+	RouteCache();
+	// Drops the least recently used routes down to capacity; 0 turns the cache off
+	void setCapacity(int capacity);
+	int capacity() const;
+
+	// If a route from start to end is cached, copies its edges and length and whether there
+	// is one at all into edges, distance and found, and returns true
+	bool lookup(unsigned int generation, NodeId start, NodeId end,
+		std::vector<uint32_t>& edges, double& distance, bool& found);
+	// Caches the outcome of a search from start to end
+	void insert(unsigned int generation, NodeId start, NodeId end,
+		const std::vector<uint32_t>& edges, double distance, bool found);
+	void clear(); // Drops every route, counting it as an invalidation
+	RouteCacheStats stats() const;
+private:
+	static const int NONE = -1;
+
+	struct Entry
+	{
+		RouteKey key;
+		std::vector<uint32_t> edges;
+		double distance;
+		bool found;
+		int newer; // Neighbors in order of use, NONE at either end
+		int older;
+	};
+
+	mutable std::mutex m_mutex;
+	int m_capacity;
+	unsigned int m_generation; // The map generation of every cached route
+	std::vector<Entry> m_entries;
+	ExpandableHashMap<RouteKey, int> m_index; // Entry of each cached route
+	int m_newest;
+	int m_oldest;
+	RouteCacheStats m_stats;
+
+	void checkGeneration(unsigned int generation);
+	void dropAll();
+	void unlink(int i);
+	void pushNewest(int i);
+};
+
+#endif
@@ -0,0 +1,252 @@
+#include "RouteSearch.h"
+#include "Landmarks.h"
+#include "support.h"
+#include <algorithm>
+#include <limits>
+using namespace std;
+
+SearchSpace::SearchSpace()
+{
+	m_generation = 0;
+}
+
+void SearchSpace::begin(uint32_t numNodes)
+{
+	if (m_distance.size() < numNodes) {
+		m_distance.resize(numNodes);
+		m_parent.resize(numNodes);
+		m_parentEdge.resize(numNodes);
+		m_reached.resize(numNodes, 0);
+		m_settled.resize(numNodes, 0);
+	}
+	heap.resize(numNodes);
+	heap.clear();
+	// Once the counter wraps, old stamps could look current again, so wipe them
+	if (++m_generation == 0) {
+		fill(m_reached.begin(), m_reached.end(), 0);
+		fill(m_settled.begin(), m_settled.end(), 0);
+		m_generation = 1;
+	}
+}
+
+SearchSpace& threadSearchSpace(int direction)
+{
+	thread_local SearchSpace spaces[2];
+	return spaces[direction];
+}
+
+namespace {
+	// A* with any consistent heuristic h(n), an estimate of the distance from n to end
+	// that never overestimates.  An infinite estimate means end can't be reached from n.
+	template<typename Heuristic>
+	bool aStar(const StreetGraph& g, NodeId start, NodeId end, Heuristic h,
+		vector<uint32_t>& edges, double& distance, RouteStats* stats)
+	{
+		SearchSpace& space = threadSearchSpace();
+		space.begin(g.numNodes);
+
+		space.reach(start, 0, NO_NODE, 0);
+		space.heap.pushOrDecrease(start, 0);
+		while (!space.heap.empty()) {
+			NodeId cur = space.heap.pop();
+			space.settle(cur);
+			if (stats != nullptr)
+				stats->nodesSettled++;
+
+			if (cur == end) {
+				// Walks the parent edges back to start
+				edges.clear();
+				for (NodeId n = end; n != start; n = space.parent(n))
+					edges.push_back(space.parentEdge(n));
+				reverse(edges.begin(), edges.end());
+				distance = space.distance(end);
+				return true;
+			}
+
+			double curDistance = space.distance(cur);
+			StreetEdgeRange neighbors = g.edges(cur);
+			for (int i = 0; i < neighbors.count; i++) {
+				NodeId neighbor = neighbors.target[i];
+				if (space.settled(neighbor))
+					continue;
+				double tentative = curDistance + neighbors.length[i];
+				if (tentative < space.distance(neighbor)) {
+					// Since h never overestimates, the first time end is settled its path is shortest
+					double estimate = h(neighbor);
+					if (estimate == numeric_limits<double>::infinity())
+						continue;
+					space.reach(neighbor, tentative, cur, neighbors.firstEdge + i);
+					space.heap.pushOrDecrease(neighbor, tentative + estimate);
+				}
+			}
+		}
+		return false;
+	}
+}
+
+bool aStarSearch(const StreetGraph& g, NodeId start, NodeId end,
+	vector<uint32_t>& edges, double& distance, RouteStats* stats)
+{
+	// The straight-line distance to end
+	auto crow = [&](NodeId n) {
+		return g.chordMiles(n, end);
+	};
+	return aStar(g, start, end, crow, edges, distance, stats);
+}
+
+bool landmarkSearch(const StreetGraph& g, const Landmarks& landmarks, NodeId start, NodeId end,
+	vector<uint32_t>& edges, double& distance, RouteStats* stats)
+{
+	// The landmark bound is often tighter than the straight line, but not always, so
+	// this takes whichever is larger; the larger of two lower bounds is still one
+	LandmarkTarget target(landmarks, end);
+	auto bound = [&](NodeId n) {
+		return max(g.chordMiles(n, end), target.lowerBound(n));
+	};
+	return aStar(g, start, end, bound, edges, distance, stats);
+}
+
+void shortestDistances(const StreetGraph& g, NodeId source, bool backward, vector<double>& distances)
+{
+	SearchSpace& space = threadSearchSpace();
+	space.begin(g.numNodes);
+	distances.assign(g.numNodes, numeric_limits<double>::infinity());
+
+	// Plain Dijkstra, run until every reachable node is settled
+	space.reach(source, 0, NO_NODE, 0);
+	space.heap.pushOrDecrease(source, 0);
+	while (!space.heap.empty()) {
+		NodeId cur = space.heap.pop();
+		space.settle(cur);
+		double curDistance = space.distance(cur);
+		distances[cur] = curDistance;
+
+		uint32_t first = backward ? g.reverseOffsets[cur] : g.edgeOffsets[cur];
+		uint32_t last = backward ? g.reverseOffsets[cur + 1] : g.edgeOffsets[cur + 1];
+		for (uint32_t i = first; i < last; i++) {
+			uint32_t edge = backward ? g.reverseEdges[i] : i;
+			NodeId neighbor = backward ? g.reverseSources[i] : g.edgeTargets[i];
+			if (space.settled(neighbor))
+				continue;
+			double tentative = curDistance + g.edgeLengths[edge];
+			if (tentative < space.distance(neighbor)) {
+				space.reach(neighbor, tentative, cur, edge);
+				space.heap.pushOrDecrease(neighbor, tentative);
+			}
+		}
+	}
+}
+
+bool bidirectionalSearch(const StreetGraph& g, NodeId start, NodeId end,
+	vector<uint32_t>& edges, double& distance, RouteStats* stats)
+{
+	SearchSpace& forward = threadSearchSpace(0);
+	SearchSpace& backward = threadSearchSpace(1);
+	forward.begin(g.numNodes);
+	backward.begin(g.numNodes);
+
+	// Both directions use the average of the two straight-line estimates, which keeps the
+	// reduced edge lengths of the two searches consistent with each other
+	auto potential = [&](NodeId n) {
+		return (g.chordMiles(n, end) - g.chordMiles(n, start)) / 2;
+	};
+
+	double best = numeric_limits<double>::infinity(); // Shortest start-end path seen so far
+	NodeId meeting = NO_NODE; // The node that path goes through
+	forward.reach(start, 0, NO_NODE, 0);
+	forward.heap.pushOrDecrease(start, potential(start));
+	backward.reach(end, 0, NO_NODE, 0);
+	backward.heap.pushOrDecrease(end, -potential(end));
+	if (start == end) {
+		best = 0;
+		meeting = start;
+	}
+
+	while (!forward.heap.empty() && !backward.heap.empty()) {
+		// Once the two smallest keys add up to the best path, no unsettled node can improve on it
+		if (forward.heap.topKey() + backward.heap.topKey() >= best)
+			break;
+
+		// Expands the direction with the smaller open list
+		bool isForward = forward.heap.size() <= backward.heap.size();
+		SearchSpace& space = isForward ? forward : backward;
+		SearchSpace& other = isForward ? backward : forward;
+		NodeId cur = space.heap.pop();
+		space.settle(cur);
+		if (stats != nullptr)
+			stats->nodesSettled++;
+
+		double curDistance = space.distance(cur);
+		uint32_t first = isForward ? g.edgeOffsets[cur] : g.reverseOffsets[cur];
+		uint32_t last = isForward ? g.edgeOffsets[cur + 1] : g.reverseOffsets[cur + 1];
+		for (uint32_t i = first; i < last; i++) {
+			// Backward, the edge runs from neighbor into cur
+			uint32_t edge = isForward ? i : g.reverseEdges[i];
+			NodeId neighbor = isForward ? g.edgeTargets[i] : g.reverseSources[i];
+			if (space.settled(neighbor))
+				continue;
+			double tentative = curDistance + g.edgeLengths[edge];
+			if (tentative < space.distance(neighbor)) {
+				space.reach(neighbor, tentative, cur, edge);
+				double p = potential(neighbor);
+				space.heap.pushOrDecrease(neighbor, tentative + (isForward ? p : -p));
+				if (other.reached(neighbor) && tentative + other.distance(neighbor) < best) {
+					best = tentative + other.distance(neighbor);
+					meeting = neighbor;
+				}
+			}
+		}
+	}
+	if (meeting == NO_NODE)
+		return false;
+
+	// Splices the forward path to the meeting node onto the backward path from it
+	edges.clear();
+	for (NodeId n = meeting; n != start; n = forward.parent(n))
+		edges.push_back(forward.parentEdge(n));
+	reverse(edges.begin(), edges.end());
+	for (NodeId n = meeting; n != end; n = backward.parent(n))
+		edges.push_back(backward.parentEdge(n));
+	distance = best;
+	return true;
+}
+
+void oneToManyDistances(const StreetGraph& g, NodeId source, const vector<NodeId>& targets,
+	vector<double>& distances)
+{
+	SearchSpace& space = threadSearchSpace();
+	space.begin(g.numNodes);
+
+	// Targets are looked up by binary search as nodes settle; there are only a few of them
+	vector<NodeId> remaining(targets);
+	sort(remaining.begin(), remaining.end());
+	remaining.erase(unique(remaining.begin(), remaining.end()), remaining.end());
+	size_t numRemaining = remaining.size();
+
+	space.reach(source, 0, NO_NODE, 0);
+	space.heap.pushOrDecrease(source, 0);
+	while (!space.heap.empty() && numRemaining > 0) {
+		NodeId cur = space.heap.pop();
+		space.settle(cur);
+		if (binary_search(remaining.begin(), remaining.end(), cur))
+			numRemaining--;
+
+		double curDistance = space.distance(cur);
+		StreetEdgeRange neighbors = g.edges(cur);
+		for (int i = 0; i < neighbors.count; i++) {
+			NodeId neighbor = neighbors.target[i];
+			if (space.settled(neighbor))
+				continue;
+			double tentative = curDistance + neighbors.length[i];
+			if (tentative < space.distance(neighbor)) {
+				space.reach(neighbor, tentative, cur, neighbors.firstEdge + i);
+				space.heap.pushOrDecrease(neighbor, tentative);
+			}
+		}
+	}
+
+	// A target that never settled has no path; its label, if any, is only a tentative one
+	distances.resize(targets.size());
+	for (size_t i = 0; i < targets.size(); i++)
+		distances[i] = space.settled(targets[i]) ? space.distance(targets[i]) : numeric_limits<double>::infinity();
+}
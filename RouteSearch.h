@@ -0,0 +1,75 @@
+// RouteSearch.h
+
+// Shortest-path searches over a StreetGraph.  A search keeps its labels in a
+// SearchSpace: dense per-node arrays that are reused from query to query and reset
+// by bumping a generation counter, so a query only touches the nodes it visits.
+#ifndef ROUTESEARCH_H
+#define ROUTESEARCH_H
+
+#include "provided.h"
+#include "IndexedHeap.h"
+#include "StreetGraph.h"
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+class Landmarks;
+
+class SearchSpace
+{
+public:
+	SearchSpace();
+	void begin(uint32_t numNodes); // Forgets the previous query's labels in O(1)
+
+	bool reached(NodeId n) const { return m_reached[n] == m_generation; }
+	bool settled(NodeId n) const { return m_settled[n] == m_generation; }
+	double distance(NodeId n) const { return reached(n) ? m_distance[n] : std::numeric_limits<double>::infinity(); }
+	NodeId parent(NodeId n) const { return m_parent[n]; }
+	uint32_t parentEdge(NodeId n) const { return m_parentEdge[n]; }
+
+	// Records that n can be reached with distance d by edge from parent
+	void reach(NodeId n, double d, NodeId parent, uint32_t edge)
+	{
+		m_reached[n] = m_generation;
+		m_distance[n] = d;
+		m_parent[n] = parent;
+		m_parentEdge[n] = edge;
+	}
+	void settle(NodeId n) { m_settled[n] = m_generation; }
+
+	IndexedHeap<4> heap; // Open list, keyed by distance plus heuristic
+private:
+	std::vector<double> m_distance;
+	std::vector<NodeId> m_parent;
+	std::vector<uint32_t> m_parentEdge;
+	std::vector<uint32_t> m_reached; // Generation in which each node was last reached
+	std::vector<uint32_t> m_settled; // Generation in which each node was last settled
+	uint32_t m_generation;
+};
+
+// This thread's search space for one search direction (0 or 1), reused by every query
+SearchSpace& threadSearchSpace(int direction = 0);
+
+// Finds a shortest path from start to end with A*, putting the ids of the edges along
+// it in edges.  Returns false if end can't be reached.
+bool aStarSearch(const StreetGraph& g, NodeId start, NodeId end,
+	std::vector<uint32_t>& edges, double& distance, RouteStats* stats);
+
+// Same as aStarSearch, but searches forward from start and backward from end at once
+bool bidirectionalSearch(const StreetGraph& g, NodeId start, NodeId end,
+	std::vector<uint32_t>& edges, double& distance, RouteStats* stats);
+
+// Same as aStarSearch, but also bounds the distance left with precomputed landmark distances
+bool landmarkSearch(const StreetGraph& g, const Landmarks& landmarks, NodeId start, NodeId end,
+	std::vector<uint32_t>& edges, double& distance, RouteStats* stats);
+
+// Fills distances with the length of a shortest path from source to every node (or, if
+// backward, from every node to source); infinity where there is none
+void shortestDistances(const StreetGraph& g, NodeId source, bool backward, std::vector<double>& distances);
+
+// Fills distances[i] with the length of a shortest path from source to targets[i], or
+// infinity if there is none.  The search stops as soon as every target is settled.
+void oneToManyDistances(const StreetGraph& g, NodeId source, const std::vector<NodeId>& targets,
+	std::vector<double>& distances);
+
+#endif
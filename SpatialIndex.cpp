@@ -0,0 +1,218 @@
+#include "SpatialIndex.h"
+#include "support.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+using namespace std;
+
+namespace {
+	// Distance along the Hilbert curve through a 65536 x 65536 grid to the cell (x, y)
+	uint32_t hilbertIndex(uint32_t x, uint32_t y)
+	{
+		const uint32_t n = 1 << 16;
+		uint32_t d = 0;
+		for (uint32_t s = n / 2; s > 0; s /= 2) {
+			uint32_t rx = (x & s) > 0, ry = (y & s) > 0;
+			d += s * s * ((3 * rx) ^ ry);
+			// Rotates the quadrant so the curve inside it runs the same way as the whole
+			if (ry == 0) {
+				if (rx == 1) {
+					x = n - 1 - x;
+					y = n - 1 - y;
+				}
+				swap(x, y);
+			}
+		}
+		return d;
+	}
+}
+
+// The point being snapped and the best segment so far, in the map's fixed point units
+// (with longitude scaled to match latitude), which saves converting every end point back
+// to degrees
+struct SpatialIndex::Query
+{
+	double lat;
+	double lon;
+	double lonScale;
+	double best; // Squared distance to the closest point so far
+	const Segment* bestSegment;
+	double bestFraction;
+
+	double distance(const Box& box) const
+	{
+		double dy = max(max(box.minLat - lat, lat - box.maxLat), 0.0);
+		double dx = max(max(box.minLon - lon, lon - box.maxLon), 0.0) * lonScale;
+		return dx * dx + dy * dy;
+	}
+};
+
+SpatialIndex::SpatialIndex()
+{
+	m_levelOffsets.assign(1, 0);
+}
+
+void SpatialIndex::build(const StreetGraph& g)
+{
+	m_segments.clear();
+	m_boxes.clear();
+	m_levelOffsets.assign(1, 0);
+
+	// Every segment is stored in both directions, so keep one edge of each pair; an edge
+	// with no reverse is kept whichever way it runs
+	vector<Segment> segments;
+	for (uint32_t s = 0; s < g.numNodes; s++)
+		for (uint32_t e = g.edgeOffsets[s]; e < g.edgeOffsets[s + 1]; e++) {
+			uint32_t t = g.edgeTargets[e];
+			bool keep = true;
+			for (uint32_t r = g.edgeOffsets[t]; s > t && keep && r < g.edgeOffsets[t + 1]; r++)
+				keep = g.edgeTargets[r] != s;
+			if (keep) {
+				Segment segment = { g.coords[s], g.coords[t], s, e, t };
+				segments.push_back(segment);
+			}
+		}
+	if (segments.empty())
+		return;
+
+	// Sorts the segments along a Hilbert curve through the bounding box of their centers,
+	// so segments near each other on the map end up near each other in the array
+	double minLat = numeric_limits<double>::infinity(), minLon = minLat;
+	double maxLat = -minLat, maxLon = -minLat;
+	for (size_t i = 0; i < segments.size(); i++) {
+		double lat = ((double)segments[i].start.lat + segments[i].end.lat) / 2;
+		double lon = ((double)segments[i].start.lon + segments[i].end.lon) / 2;
+		minLat = min(minLat, lat);
+		minLon = min(minLon, lon);
+		maxLat = max(maxLat, lat);
+		maxLon = max(maxLon, lon);
+	}
+	double latScale = 65535 / max(maxLat - minLat, 1.0), lonScale = 65535 / max(maxLon - minLon, 1.0);
+	vector<pair<uint32_t, uint32_t>> order; // Hilbert index and position of each segment
+	for (size_t i = 0; i < segments.size(); i++) {
+		double lat = ((double)segments[i].start.lat + segments[i].end.lat) / 2;
+		double lon = ((double)segments[i].start.lon + segments[i].end.lon) / 2;
+		order.push_back(make_pair(hilbertIndex((uint32_t)((lon - minLon) * lonScale), (uint32_t)((lat - minLat) * latScale)), (uint32_t)i));
+	}
+	sort(order.begin(), order.end());
+	m_segments.reserve(segments.size());
+	for (size_t i = 0; i < order.size(); i++)
+		m_segments.push_back(segments[order[i].second]);
+
+	// The leaves box FANOUT segments each, and each level above boxes FANOUT boxes of the
+	// one below, up to a single box around everything
+	for (size_t i = 0; i < m_segments.size(); i += FANOUT) {
+		const Segment& first = m_segments[i];
+		Box box = { min(first.start.lat, first.end.lat), min(first.start.lon, first.end.lon),
+			max(first.start.lat, first.end.lat), max(first.start.lon, first.end.lon) };
+		for (size_t j = i + 1; j < min(i + FANOUT, m_segments.size()); j++) {
+			const Segment& segment = m_segments[j];
+			box.minLat = min(box.minLat, min(segment.start.lat, segment.end.lat));
+			box.minLon = min(box.minLon, min(segment.start.lon, segment.end.lon));
+			box.maxLat = max(box.maxLat, max(segment.start.lat, segment.end.lat));
+			box.maxLon = max(box.maxLon, max(segment.start.lon, segment.end.lon));
+		}
+		m_boxes.push_back(box);
+	}
+	m_levelOffsets.push_back(m_boxes.size());
+	while (m_levelOffsets.back() - m_levelOffsets[m_levelOffsets.size() - 2] > 1) {
+		size_t begin = m_levelOffsets[m_levelOffsets.size() - 2], end = m_levelOffsets.back();
+		for (size_t i = begin; i < end; i += FANOUT) {
+			Box box = m_boxes[i];
+			for (size_t j = i + 1; j < min(i + FANOUT, end); j++) {
+				box.minLat = min(box.minLat, m_boxes[j].minLat);
+				box.minLon = min(box.minLon, m_boxes[j].minLon);
+				box.maxLat = max(box.maxLat, m_boxes[j].maxLat);
+				box.maxLon = max(box.maxLon, m_boxes[j].maxLon);
+			}
+			m_boxes.push_back(box);
+		}
+		m_levelOffsets.push_back(m_boxes.size());
+	}
+}
+
+bool SpatialIndex::snap(double latitude, double longitude, NetworkSnap& snap) const
+{
+	if (m_segments.empty())
+		return false;
+
+	Query query;
+	query.lat = latitude * 1e7;
+	query.lon = longitude * 1e7;
+	query.lonScale = cos(deg2rad(latitude));
+	query.best = numeric_limits<double>::infinity();
+	query.bestSegment = nullptr;
+	query.bestFraction = 0;
+	search((int)m_levelOffsets.size() - 2, 0, query);
+	if (query.bestSegment == nullptr) // Only if the point isn't a number
+		return false;
+
+	const Segment& best = *query.bestSegment;
+	snap.edge = best.edge;
+	snap.fraction = query.bestFraction;
+	snap.node = query.bestFraction <= 0.5 ? best.source : best.target;
+	snap.latitude = best.start.latitude() + query.bestFraction * (best.end.latitude() - best.start.latitude());
+	snap.longitude = best.start.longitude() + query.bestFraction * (best.end.longitude() - best.start.longitude());
+	snap.distance = distanceEarthMiles(latitude, longitude, snap.latitude, snap.longitude);
+	return true;
+}
+
+void SpatialIndex::search(int level, size_t box, Query& query) const
+{
+	size_t first = box * FANOUT;
+	if (level == 0) {
+		for (size_t i = first; i < min(first + FANOUT, m_segments.size()); i++) {
+			const Segment& segment = m_segments[i];
+			// Relative to the point.  Compares squared distances scaled by the segment's
+			// squared length, so only the closest segment needs a division.
+			double ax = (segment.start.lon - query.lon) * query.lonScale, ay = segment.start.lat - query.lat;
+			double dx = ((double)segment.end.lon - segment.start.lon) * query.lonScale, dy = (double)segment.end.lat - segment.start.lat;
+			double along = -(ax * dx + ay * dy), lengthSquared = dx * dx + dy * dy;
+			double fromStart = ax * ax + ay * ay;
+			if (along <= 0) {
+				if (fromStart < query.best) {
+					query.best = fromStart;
+					query.bestSegment = &segment;
+					query.bestFraction = 0;
+				}
+			}
+			else if (along >= lengthSquared) {
+				double bx = ax + dx, by = ay + dy;
+				if (bx * bx + by * by < query.best) {
+					query.best = bx * bx + by * by;
+					query.bestSegment = &segment;
+					query.bestFraction = 1;
+				}
+			}
+			else if (fromStart * lengthSquared - along * along < query.best * lengthSquared) {
+				query.best = max(fromStart - along * along / lengthSquared, 0.0);
+				query.bestSegment = &segment;
+				query.bestFraction = along / lengthSquared;
+			}
+		}
+		return;
+	}
+
+	// Visits the boxes below nearest first, so the farther ones are more often skipped
+	size_t begin = m_levelOffsets[level - 1], count = min<size_t>(FANOUT, m_levelOffsets[level] - begin - first);
+	double distances[FANOUT];
+	int children[FANOUT];
+	for (size_t i = 0; i < count; i++) {
+		double distance = query.distance(m_boxes[begin + first + i]);
+		size_t j = i;
+		for (; j > 0 && distances[j - 1] > distance; j--) {
+			distances[j] = distances[j - 1];
+			children[j] = children[j - 1];
+		}
+		distances[j] = distance;
+		children[j] = (int)i;
+	}
+	for (size_t i = 0; i < count && distances[i] < query.best; i++)
+		search(level - 1, first + children[i], query);
+}
+
+size_t SpatialIndex::bytesUsed() const
+{
+	return m_segments.capacity() * sizeof(Segment) + m_boxes.capacity() * sizeof(Box) + m_levelOffsets.capacity() * sizeof(size_t);
+}
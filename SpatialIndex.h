@@ -0,0 +1,61 @@
+// SpatialIndex.h
+
+// A packed R-tree over a StreetGraph's segments, for finding the street nearest an
+// arbitrary point.  The segments are sorted along a Hilbert curve through their centers
+// and cut into leaves of a few consecutive segments; each level above boxes a few
+// consecutive boxes of the one below, so the tree is just arrays, with no pointers, and
+// its boxes stay small wherever the streets are dense.  A lookup descends into the
+// nearest boxes first and skips any box farther away than the best point found.
+//
+// Distances are measured on a local flat projection (longitude scaled by the cosine of
+// the point's latitude), which over the few blocks a lookup spans differs from the great
+// circle by far less than a block.
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include "provided.h"
+#include "StreetGraph.h"
+#include <cstdint>
+#include <vector>
+
+class SpatialIndex
+{
+public:
+	SpatialIndex();
+	void build(const StreetGraph& g);
+
+	// Finds the point on any segment closest to the given point.  Returns false if the map
+	// has no segments.
+	bool snap(double latitude, double longitude, NetworkSnap& snap) const;
+
+	size_t bytesUsed() const;
+private:
+	static const int FANOUT = 8; // Segments per leaf, and boxes per box above them
+
+	// A segment, as the edge from its lower-numbered point; the reverse edge is left out.
+	// The end points are copied in so a leaf's segments sit together.
+	struct Segment {
+		FixedCoord start;
+		FixedCoord end;
+		uint32_t source;
+		uint32_t edge;
+		uint32_t target;
+	};
+	struct Box {
+		int32_t minLat;
+		int32_t minLon;
+		int32_t maxLat;
+		int32_t maxLon;
+	};
+	struct Query;
+
+	std::vector<Segment> m_segments; // In Hilbert order
+	// Every level's boxes, leaves first; box i of a level covers items [i * FANOUT, (i + 1) * FANOUT)
+	// of the level below, the leaves' items being segments
+	std::vector<Box> m_boxes;
+	std::vector<size_t> m_levelOffsets; // Level i's boxes are [m_levelOffsets[i], m_levelOffsets[i + 1])
+
+	void search(int level, size_t box, Query& query) const;
+};
+
+#endif
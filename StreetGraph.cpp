@@ -0,0 +1,504 @@
+#include "StreetGraph.h"
+#include "ExpandableHashMap.h"
+#include "support.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <exception>
+#include <fstream>
+using namespace std;
+
+namespace {
+	// The same numbers stod and stoi give for the text, which from_chars can read much
+	// faster; anything it won't read whole (a leading '+' or space, or an error) goes to
+	// the slower functions so it's read, or rejected with an exception, exactly as before
+	double parseDouble(const char* text, size_t length)
+	{
+		double value;
+		from_chars_result result = from_chars(text, text + length, value);
+		if (result.ec != errc() || result.ptr != text + length)
+			return stod(string(text, length));
+		return value;
+	}
+
+	int parseCount(const char* text, size_t length)
+	{
+		// stoi ignores whatever follows the digits, so this only needs from_chars to start
+		int value;
+		if (from_chars(text, text + length, value).ec != errc())
+			return stoi(string(text, length));
+		return value;
+	}
+
+	// Whether node id's coordinate text, laid out as in StreetGraph, is exactly lat and lon
+	bool sameText(const char* text, const uint32_t* textOffsets, uint32_t id,
+		const char* lat, size_t latLength, const char* lon, size_t lonLength)
+	{
+		const char* latText = text + textOffsets[2 * id];
+		const char* lonText = text + textOffsets[2 * id + 1];
+		return (size_t)(lonText - latText) == latLength && textOffsets[2 * id + 2] - textOffsets[2 * id + 1] == lonLength &&
+			memcmp(latText, lat, latLength) == 0 && memcmp(lonText, lon, lonLength) == 0;
+	}
+}
+
+StreetGraph::StreetGraph()
+	: numNodes(0), numEdges(0), numNames(0), numIndexSlots(0),
+	coords(nullptr), exactCoords(true), nodePoints(nullptr), textOffsets(nullptr), text(nullptr),
+	edgeOffsets(nullptr), edgeTargets(nullptr), edgeNames(nullptr), edgeLengths(nullptr), edgeBearings(nullptr),
+	reverseOffsets(nullptr), reverseSources(nullptr), reverseEdges(nullptr),
+	nameOffsets(nullptr), names(nullptr), nodeIndex(nullptr)
+{
+}
+
+bool StreetGraph::findNode(const GeoCoord& gc, uint32_t& id) const
+{
+	if (numIndexSlots == 0)
+		return false;
+	// Linear probing from the point's home slot until an empty slot is reached.  Points are
+	// compared as integers, and only a node at the same point has its text compared.
+	FixedCoord point = FixedCoord::fromDegrees(gc.latitude, gc.longitude);
+	const string& lat = gc.latitudeText;
+	const string& lon = gc.longitudeText;
+	uint32_t mask = numIndexSlots - 1;
+	for (uint32_t slot = fixedCoordHash(point) & mask;; slot = (slot + 1) & mask) {
+		uint32_t candidate = nodeIndex[slot];
+		if (candidate == NO_NODE)
+			return false;
+		if (coords[candidate] == point && sameText(text, textOffsets, candidate, lat.data(), lat.size(), lon.data(), lon.size())) {
+			id = candidate;
+			return true;
+		}
+	}
+}
+
+GeoCoord StreetGraph::coord(uint32_t id) const
+{
+	GeoCoord gc;
+	gc.latitudeText.assign(text + textOffsets[2 * id], text + textOffsets[2 * id + 1]);
+	gc.longitudeText.assign(text + textOffsets[2 * id + 1], text + textOffsets[2 * id + 2]);
+	gc.latitude = latitude(id);
+	gc.longitude = longitude(id);
+	return gc;
+}
+
+// Text with more decimal places than a FixedCoord keeps is read again, so the numbers
+// always match what the GeoCoord constructor would give
+double StreetGraph::latitude(uint32_t id) const
+{
+	if (exactCoords)
+		return coords[id].latitude();
+	return parseDouble(text + textOffsets[2 * id], textOffsets[2 * id + 1] - textOffsets[2 * id]);
+}
+
+double StreetGraph::longitude(uint32_t id) const
+{
+	if (exactCoords)
+		return coords[id].longitude();
+	return parseDouble(text + textOffsets[2 * id + 1], textOffsets[2 * id + 2] - textOffsets[2 * id + 1]);
+}
+
+string StreetGraph::name(uint32_t nameId) const
+{
+	return string(names + nameOffsets[nameId], names + nameOffsets[nameId + 1]);
+}
+
+unsigned int hasher(const FixedCoord& c)
+{
+	return fixedCoordHash(c);
+}
+
+namespace {
+	// A coordinate's text as read from a map file
+	struct CoordText {
+		const char* latitudeText;
+		size_t latitudeLength;
+		const char* longitudeText;
+		size_t longitudeLength;
+	};
+
+	// One end of a segment, with everything about it that doesn't depend on the rest of the file
+	struct ParsedCoord {
+		CoordText text;
+		double latitude;
+		double longitude;
+		FixedCoord point;
+	};
+	struct ParsedSegment {
+		ParsedCoord start;
+		ParsedCoord end;
+		double length;
+	};
+	struct ParsedStreet {
+		const char* name;
+		size_t nameLength;
+		size_t firstSegment; // Index into the chunk's segments
+		int numSegments;
+	};
+	// The streets in one stretch of the file, parsed without looking at any other stretch
+	struct ParsedChunk {
+		const char* begin; // Where the first street's record starts
+		const char* end; // Where the next record starts after parsing, which should be the next chunk's begin
+		vector<ParsedStreet> streets;
+		vector<ParsedSegment> segments;
+		bool needsEarlierWords; // The file ended mid-segment, which parseSegment explains
+		exception_ptr error; // What the parse threw, rethrown on the loading thread
+	};
+
+	// The whitespace that extracting a string with >> skips
+	bool isSpace(char c)
+	{
+		return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+	}
+
+	// Reads the rest of the line and moves past its newline, like getline
+	void readLine(const char*& p, const char* end, const char*& line, size_t& length)
+	{
+		const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+		line = p;
+		length = (newline == nullptr ? end : newline) - p;
+		p = newline == nullptr ? end : newline + 1;
+	}
+
+	// Skips whitespace and reads the word after it, like extracting a string with >>
+	void readWord(const char*& p, const char* end, const char*& word, size_t& length)
+	{
+		while (p != end && isSpace(*p))
+			p++;
+		word = p;
+		while (p != end && !isSpace(*p))
+			p++;
+		length = p - word;
+	}
+
+	void setCoord(ParsedCoord& coord, const char* lat, size_t latLength, const char* lon, size_t lonLength)
+	{
+		coord.text = CoordText{ lat, latLength, lon, lonLength };
+		coord.latitude = parseDouble(lat, latLength);
+		coord.longitude = parseDouble(lon, lonLength);
+		coord.point = FixedCoord::fromDegrees(coord.latitude, coord.longitude);
+	}
+
+	// Reads a segment's four numbers into words.  A number the file ends before keeps the
+	// last text read for it, as a string extracted into with >> does, and if that text is
+	// in an earlier chunk (words[i] is null) this returns false.
+	bool parseSegment(const char*& p, const char* fileEnd, const char* words[4], size_t lengths[4], ParsedSegment& seg)
+	{
+		for (int i = 0; i < 4; i++) {
+			const char* word;
+			size_t length;
+			readWord(p, fileEnd, word, length);
+			if (length != 0) {
+				words[i] = word;
+				lengths[i] = length;
+			}
+			else if (words[i] == nullptr)
+				return false;
+		}
+		setCoord(seg.start, words[0], lengths[0], words[1], lengths[1]);
+		setCoord(seg.end, words[2], lengths[2], words[3], lengths[3]);
+		seg.length = distanceEarthMiles(seg.start.latitude, seg.start.longitude, seg.end.latitude, seg.end.longitude);
+		return true;
+	}
+
+	// Parses the records starting before chunkEnd, each a name line, a count line, and that
+	// many segments of four numbers, reading the text the way StreetGraphData::parse always has
+	void parseChunk(ParsedChunk& chunk, const char* chunkEnd, const char* fileBegin, const char* fileEnd)
+	{
+		// Before the first record, every number's text is empty
+		const char* words[4];
+		size_t lengths[4];
+		for (int i = 0; i < 4; i++) {
+			words[i] = chunk.begin == fileBegin ? fileBegin : nullptr;
+			lengths[i] = 0;
+		}
+		chunk.needsEarlierWords = false;
+		try {
+			const char* p = chunk.begin;
+			while (p < chunkEnd) {
+				ParsedStreet street;
+				readLine(p, fileEnd, street.name, street.nameLength);
+				const char* count;
+				size_t countLength;
+				readLine(p, fileEnd, count, countLength);
+				street.numSegments = max(parseCount(count, countLength), 0);
+				street.firstSegment = chunk.segments.size();
+				for (int i = 0; i < street.numSegments; i++) {
+					ParsedSegment seg;
+					if (!parseSegment(p, fileEnd, words, lengths, seg)) {
+						chunk.needsEarlierWords = true;
+						return;
+					}
+					chunk.segments.push_back(seg);
+				}
+				chunk.streets.push_back(street);
+
+				// Discards the rest of the last segment's line (or, with no segments, the next line)
+				const char* rest;
+				size_t restLength;
+				readLine(p, fileEnd, rest, restLength);
+			}
+			chunk.end = p;
+		}
+		catch (...) {
+			chunk.error = current_exception();
+		}
+	}
+
+	// Cuts the text at record starts into about numChunks pieces.  The record boundaries
+	// come from counting lines, assuming one segment per line, so parsing checks each
+	// piece ends where the next begins.
+	void splitRecords(const char* begin, const char* end, int numChunks, vector<ParsedChunk>& chunks)
+	{
+		size_t target = (end - begin) / numChunks + 1;
+		chunks.resize(1);
+		chunks[0].begin = begin;
+		const char* p = begin;
+		while (p < end) {
+			if ((size_t)(p - chunks.back().begin) >= target) {
+				chunks.push_back(ParsedChunk());
+				chunks.back().begin = p;
+			}
+			const char* line;
+			size_t length;
+			readLine(p, end, line, length);
+			readLine(p, end, line, length);
+			int count;
+			if (from_chars(line, line + length, count).ec != errc())
+				return; // Leaves the rest to the last piece, which will find what's wrong with it
+			for (int i = max(count, 1); i > 0 && p < end; i--)
+				readLine(p, end, line, length);
+		}
+	}
+}
+
+StreetGraphData::StreetGraphData()
+	: m_exactCoords(true)
+{
+}
+
+bool StreetGraphData::parse(const string& mapFile, bool parallel)
+{
+	// Reads the whole file at once.  Text mode, like the line-by-line reads this replaced,
+	// so line endings come out the same on every platform.
+	ifstream inFile(mapFile);
+	if (!inFile)
+		return false;
+	inFile.seekg(0, ios::end);
+	size_t fileSize = (size_t)inFile.tellg();
+	inFile.seekg(0, ios::beg);
+	string buffer(fileSize, '\0');
+	inFile.read(&buffer[0], fileSize);
+	buffer.resize((size_t)inFile.gcount());
+	const char* fileBegin = buffer.data();
+	const char* fileEnd = fileBegin + buffer.size();
+
+	*this = StreetGraphData();
+	m_textOffsets.push_back(0);
+	m_nameOffsets.push_back(0);
+
+	// Reading the numbers, hashing them and measuring the segments happens on every thread.
+	// If the pieces didn't line up, the whole file is parsed again as one piece.
+	const size_t MIN_CHUNK_BYTES = 64 * 1024;
+	int numChunks = parallel ? 4 * sharedThreadPool().numThreads() : 1;
+	numChunks = (int)max((size_t)1, min((size_t)numChunks, buffer.size() / MIN_CHUNK_BYTES));
+	vector<ParsedChunk> chunks;
+	splitRecords(fileBegin, fileEnd, numChunks, chunks);
+	sharedThreadPool().parallelFor((int)chunks.size(), [&](int i) {
+		parseChunk(chunks[i], i + 1 < (int)chunks.size() ? chunks[i + 1].begin : fileEnd, fileBegin, fileEnd);
+	});
+	for (size_t i = 0; i < chunks.size() && !chunks[i].error; i++) {
+		if (chunks[i].needsEarlierWords || (i + 1 < chunks.size() && chunks[i].end != chunks[i + 1].begin)) {
+			chunks.resize(1);
+			chunks[0] = ParsedChunk();
+			chunks[0].begin = fileBegin;
+			parseChunk(chunks[0], fileEnd, fileBegin, fileEnd);
+			break;
+		}
+	}
+
+	struct Edge {
+		uint32_t start;
+		uint32_t end;
+		uint32_t name;
+		double length;
+	};
+	vector<Edge> edges; // Every directed edge, in the order the text loader adds them
+	// Scratch tables that die with the parse, so their memory can come from arenas
+	ExpandableHashMap<FixedCoord, uint32_t, ArenaAllocator> nodeIds; // First node at each point
+	ExpandableHashMap<string, uint32_t, ArenaAllocator> nameIds; // Interns street names
+	// For each node, the next node at the same point written differently ("34.05" and
+	// "34.0500000"), which is a different GeoCoord; NO_NODE ends the list
+	vector<uint32_t> samePoint;
+
+	// A segment's line is about 48 bytes and each adds at most one new point, so the file's
+	// size bounds the number of points closely enough to size the tables once up front
+	size_t estimatedSegments = buffer.size() / 48;
+	nodeIds.reserve((int)estimatedSegments);
+	edges.reserve(2 * estimatedSegments);
+
+	// Gets the id for the coordinate with this text, adding a node if this is the first time
+	// it's seen.  Nodes are found by point, comparing integers, and their text only confirms it.
+	auto internCoord = [&](const ParsedCoord& c) {
+		uint32_t newId = (uint32_t)m_coords.size();
+		pair<uint32_t*, bool> first = nodeIds.try_emplace(c.point, newId);
+		if (!first.second) {
+			uint32_t id = *first.first, last = id;
+			for (; id != NO_NODE; last = id, id = samePoint[id])
+				if (sameText(m_text.data(), m_textOffsets.data(), id,
+					c.text.latitudeText, c.text.latitudeLength, c.text.longitudeText, c.text.longitudeLength))
+					return id;
+			samePoint[last] = newId;
+		}
+		samePoint.push_back(NO_NODE);
+		m_coords.push_back(c.point);
+		if (c.point.latitude() != c.latitude || c.point.longitude() != c.longitude)
+			m_exactCoords = false;
+		m_text.append(c.text.latitudeText, c.text.latitudeLength);
+		m_textOffsets.push_back((uint32_t)m_text.size());
+		m_text.append(c.text.longitudeText, c.text.longitudeLength);
+		m_textOffsets.push_back((uint32_t)m_text.size());
+		return newId;
+	};
+
+	// Hands out ids in file order, so every piece's nodes and names get the same ids they
+	// would from one thread reading the file start to finish
+	string street; // Reused so interning a name that's been seen doesn't allocate
+	for (size_t c = 0; c < chunks.size(); c++) {
+		const ParsedChunk& chunk = chunks[c];
+		for (size_t s = 0; s < chunk.streets.size(); s++) {
+			// Looks the name up and claims the next id for it in one probe
+			street.assign(chunk.streets[s].name, chunk.streets[s].nameLength);
+			pair<uint32_t*, bool> name = nameIds.try_emplace(street, (uint32_t)(m_nameOffsets.size() - 1));
+			uint32_t nameId = *name.first;
+			if (name.second) {
+				m_names += street;
+				m_nameOffsets.push_back((uint32_t)m_names.size());
+			}
+
+			// Each segment adds the previous segment reversed, then itself, matching StreetMapImpl::load
+			int numCoords = chunk.streets[s].numSegments;
+			const ParsedSegment* segments = chunk.segments.data() + chunk.streets[s].firstSegment;
+			Edge previous = { 0, 0, 0, 0 };
+			for (int i = 0; i < numCoords; i++) {
+				uint32_t start = internCoord(segments[i].start), end = internCoord(segments[i].end);
+				Edge seg = { start, end, nameId, segments[i].length };
+				if (i != 0)
+					edges.push_back(Edge{ previous.end, previous.start, nameId, previous.length });
+				edges.push_back(seg);
+				previous = seg;
+			}
+			if (numCoords > 1)
+				edges.push_back(Edge{ previous.end, previous.start, nameId, previous.length });
+		}
+		// A piece that failed to parse stops the load where the one thread reading it would have
+		if (chunk.error)
+			rethrow_exception(chunk.error);
+	}
+
+	// Buckets the edges by start node, keeping their original order within a node
+	uint32_t numNodes = (uint32_t)m_coords.size();
+	m_edgeOffsets.assign(numNodes + 1, 0);
+	for (size_t i = 0; i < edges.size(); i++)
+		m_edgeOffsets[edges[i].start + 1]++;
+	for (uint32_t i = 0; i < numNodes; i++)
+		m_edgeOffsets[i + 1] += m_edgeOffsets[i];
+	m_edgeTargets.resize(edges.size());
+	m_edgeNames.resize(edges.size());
+	m_edgeLengths.resize(edges.size());
+	vector<uint32_t> next(m_edgeOffsets.begin(), m_edgeOffsets.end() - 1);
+	for (size_t i = 0; i < edges.size(); i++) {
+		uint32_t e = next[edges[i].start]++;
+		m_edgeTargets[e] = edges[i].end;
+		m_edgeNames[e] = edges[i].name;
+		m_edgeLengths[e] = edges[i].length;
+	}
+
+	buildReverse();
+	buildIndex();
+	buildGeometry();
+	return true;
+}
+
+void StreetGraphData::buildIndex()
+{
+	// Keeps the index at most half full so probes stay short
+	uint32_t numNodes = (uint32_t)m_coords.size();
+	uint32_t numSlots = 16;
+	while (numSlots < 2 * numNodes)
+		numSlots *= 2;
+	m_nodeIndex.assign(numSlots, NO_NODE);
+	for (uint32_t id = 0; id < numNodes; id++) {
+		uint32_t slot = fixedCoordHash(m_coords[id]) & (numSlots - 1);
+		while (m_nodeIndex[slot] != NO_NODE)
+			slot = (slot + 1) & (numSlots - 1);
+		m_nodeIndex[slot] = id;
+	}
+}
+
+void StreetGraphData::buildReverse()
+{
+	// Buckets the edges by end node; scanning sources in order keeps each bucket sorted by edge id
+	uint32_t numNodes = (uint32_t)m_coords.size();
+	m_reverseOffsets.assign(numNodes + 1, 0);
+	for (size_t e = 0; e < m_edgeTargets.size(); e++)
+		m_reverseOffsets[m_edgeTargets[e] + 1]++;
+	for (uint32_t i = 0; i < numNodes; i++)
+		m_reverseOffsets[i + 1] += m_reverseOffsets[i];
+	m_reverseSources.resize(m_edgeTargets.size());
+	m_reverseEdges.resize(m_edgeTargets.size());
+	vector<uint32_t> next(m_reverseOffsets.begin(), m_reverseOffsets.end() - 1);
+	for (uint32_t source = 0; source < numNodes; source++) {
+		for (uint32_t e = m_edgeOffsets[source]; e < m_edgeOffsets[source + 1]; e++) {
+			uint32_t r = next[m_edgeTargets[e]]++;
+			m_reverseSources[r] = source;
+			m_reverseEdges[r] = e;
+		}
+	}
+}
+
+void StreetGraphData::buildGeometry()
+{
+	// From the same numbers coord() gives, so a bearing is exactly the angle the segment's
+	// GeoCoords would produce
+	StreetGraph g = view();
+	m_nodePoints.resize(3 * (size_t)g.numNodes);
+	for (uint32_t n = 0; n < g.numNodes; n++) {
+		double lat = deg2rad(g.latitude(n)), lon = deg2rad(g.longitude(n));
+		m_nodePoints[3 * (size_t)n] = cos(lat) * cos(lon);
+		m_nodePoints[3 * (size_t)n + 1] = cos(lat) * sin(lon);
+		m_nodePoints[3 * (size_t)n + 2] = sin(lat);
+	}
+	m_edgeBearings.resize(g.numEdges);
+	for (uint32_t source = 0; source < g.numNodes; source++) {
+		double lat = g.latitude(source), lon = g.longitude(source);
+		for (uint32_t e = g.edgeOffsets[source]; e < g.edgeOffsets[source + 1]; e++)
+			m_edgeBearings[e] = atan2(g.latitude(g.edgeTargets[e]) - lat, g.longitude(g.edgeTargets[e]) - lon);
+	}
+}
+
+StreetGraph StreetGraphData::view() const
+{
+	StreetGraph g;
+	g.numNodes = (uint32_t)m_coords.size();
+	g.numEdges = (uint32_t)m_edgeTargets.size();
+	g.numNames = m_nameOffsets.empty() ? 0 : (uint32_t)(m_nameOffsets.size() - 1);
+	g.numIndexSlots = (uint32_t)m_nodeIndex.size();
+	g.coords = m_coords.data();
+	g.exactCoords = m_exactCoords;
+	g.nodePoints = m_nodePoints.data();
+	g.textOffsets = m_textOffsets.data();
+	g.text = m_text.data();
+	g.edgeOffsets = m_edgeOffsets.data();
+	g.edgeTargets = m_edgeTargets.data();
+	g.edgeNames = m_edgeNames.data();
+	g.edgeLengths = m_edgeLengths.data();
+	g.edgeBearings = m_edgeBearings.data();
+	g.reverseOffsets = m_reverseOffsets.data();
+	g.reverseSources = m_reverseSources.data();
+	g.reverseEdges = m_reverseEdges.data();
+	g.nameOffsets = m_nameOffsets.data();
+	g.names = m_names.data();
+	g.nodeIndex = m_nodeIndex.data();
+	return g;
+}
@@ -0,0 +1,183 @@
+// StreetGraph.h
+
+// Flat, read-only representation of a street map.  Every distinct coordinate is a
+// node, every StreetSegment is a directed edge, and street names are interned into
+// one table.  A StreetGraph only points at its arrays; they are owned either by a
+// StreetGraphData (built from map text) or by a mapped binary map file.
+#ifndef STREETGRAPH_H
+#define STREETGRAPH_H
+
+#include "provided.h"
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+const uint32_t NO_NODE = 0xFFFFFFFF; // Marks an empty slot in the node index
+const double EARTH_RADIUS_MILES = 6371.0 / 1.609344; // The radius distanceEarthMiles uses
+
+// A point in fixed point, ten-millionths of a degree on each axis: 8 bytes, where a GeoCoord
+// holds two strings and two doubles.  Map files give coordinates to 7 decimal places, which
+// this holds exactly, and dividing back gives the very double stod reads from their text.
+struct FixedCoord
+{
+	int32_t lat;
+	int32_t lon;
+
+	static FixedCoord fromDegrees(double latitude, double longitude)
+	{
+		FixedCoord c = { toFixed(latitude), toFixed(longitude) };
+		return c;
+	}
+	double latitude() const { return lat / 1e7; }
+	double longitude() const { return lon / 1e7; }
+
+	// Rounds to the nearest ten-millionth, pinning anything out of range (or NaN) inside it
+	static int32_t toFixed(double degrees)
+	{
+		double scaled = degrees * 1e7;
+		if (!(scaled > -2147483647.0))
+			return scaled > 0 ? 2147483647 : -2147483647;
+		if (scaled > 2147483647.0)
+			return 2147483647;
+		return (int32_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+	}
+};
+
+inline bool operator==(FixedCoord a, FixedCoord b)
+{
+	return a.lat == b.lat && a.lon == b.lon;
+}
+
+// Hash of a point, for the node index (so stored in map files) and for hashing GeoCoords
+// without touching their text.  Equal GeoCoords have equal text, so parse to equal values
+// and round to equal points, which hash alike.
+inline uint32_t fixedCoordHash(FixedCoord c)
+{
+	// The 64-bit MurmurHash3 finalizer over both axes
+	uint64_t h = ((uint64_t)(uint32_t)c.lat << 32) | (uint32_t)c.lon;
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h >> 33;
+	return (uint32_t)h;
+}
+
+struct StreetGraph
+{
+	StreetGraph();
+
+	uint32_t numNodes;
+	uint32_t numEdges;
+	uint32_t numNames;
+	uint32_t numIndexSlots; // Always a power of two
+
+	const FixedCoord* coords; // numNodes entries
+	bool exactCoords; // Whether every point converts back to exactly the double its text reads as
+	const double* nodePoints; // 3 * numNodes entries, each point's x, y and z on a sphere of radius 1
+	const uint32_t* textOffsets; // 2 * numNodes + 1 entries, latitude then longitude text per node
+	const char* text;
+
+	const uint32_t* edgeOffsets; // numNodes + 1 entries, edges of node i are [edgeOffsets[i], edgeOffsets[i + 1])
+	const uint32_t* edgeTargets; // numEdges entries
+	const uint32_t* edgeNames; // numEdges entries
+	const double* edgeLengths; // numEdges entries, in miles
+	// numEdges entries, the angle of each edge in radians as angleOfLine measures it (atan2 of
+	// the latitude and longitude differences), before it's turned into degrees
+	const double* edgeBearings;
+
+	// The same edges grouped by the node they end at, for searching backward from a destination
+	const uint32_t* reverseOffsets; // numNodes + 1 entries, edges into node i are [reverseOffsets[i], reverseOffsets[i + 1])
+	const uint32_t* reverseSources; // numEdges entries, the node each edge starts at
+	const uint32_t* reverseEdges; // numEdges entries, the edge's id in the forward arrays
+
+	const uint32_t* nameOffsets; // numNames + 1 entries
+	const char* names;
+
+	const uint32_t* nodeIndex; // numIndexSlots entries of node ids, open addressing on fixedCoordHash
+
+	StreetEdgeRange edges(uint32_t id) const
+	{
+		uint32_t first = edgeOffsets[id];
+		StreetEdgeRange range;
+		range.target = edgeTargets + first;
+		range.nameId = edgeNames + first;
+		range.length = edgeLengths + first;
+		range.firstEdge = first;
+		range.count = (int)(edgeOffsets[id + 1] - first);
+		return range;
+	}
+
+	// The straight line through the earth between two points, in miles.  The line is never
+	// longer than the distance over the surface, so it's a lower bound on any route, and is
+	// shorter by less than 0.003% for points within a hundred miles; finding it takes no
+	// trigonometry.
+	double chordMiles(uint32_t a, uint32_t b) const
+	{
+		const double* p = nodePoints + 3 * (size_t)a;
+		const double* q = nodePoints + 3 * (size_t)b;
+		double dx = p[0] - q[0], dy = p[1] - q[1], dz = p[2] - q[2];
+		return EARTH_RADIUS_MILES * std::sqrt(dx * dx + dy * dy + dz * dz);
+	}
+
+	bool findNode(const GeoCoord& gc, uint32_t& id) const; // Finds the node whose text matches gc
+	GeoCoord coord(uint32_t id) const; // Builds the GeoCoord for a node
+	// A node's coordinates in degrees, the same numbers coord(id) gives
+	double latitude(uint32_t id) const;
+	double longitude(uint32_t id) const;
+	std::string name(uint32_t nameId) const; // Gets the text of a street name
+};
+
+class ConnectedComponents;
+class ContractionHierarchy;
+class Landmarks;
+
+// The tables behind a StreetMap and what's built from them, for the routing and planning
+// code.  They stay out of StreetMap's public interface, which makes this class a friend.
+class StreetMapInternals
+{
+public:
+	static const StreetGraph& graph(const StreetMap& sm); // The flat tables behind StreetMap's lookups
+	// Preprocessing for the loaded map, built on first use and shared by all routers
+	static const ConnectedComponents& components(const StreetMap& sm); // Which points can reach which
+	static const ContractionHierarchy& contractionHierarchy(const StreetMap& sm);
+	static const Landmarks& landmarks(const StreetMap& sm);
+	// A number that changes with every load of any map, so anything kept about the map's
+	// points and segments (such as a router's cached routes) can tell it's out of date
+	static unsigned int generation(const StreetMap& sm);
+};
+
+// Owning storage for a StreetGraph, built by parsing a map text file
+class StreetGraphData
+{
+public:
+	StreetGraphData();
+	// Parses the map text, splitting the work across sharedThreadPool() unless parallel is
+	// false.  Either way builds exactly the same tables.
+	bool parse(const std::string& mapFile, bool parallel = true);
+	StreetGraph view() const;
+private:
+	std::vector<FixedCoord> m_coords;
+	bool m_exactCoords;
+	std::vector<double> m_nodePoints;
+	std::vector<uint32_t> m_textOffsets;
+	std::string m_text;
+	std::vector<uint32_t> m_edgeOffsets;
+	std::vector<uint32_t> m_edgeTargets;
+	std::vector<uint32_t> m_edgeNames;
+	std::vector<double> m_edgeLengths;
+	std::vector<double> m_edgeBearings;
+	std::vector<uint32_t> m_reverseOffsets;
+	std::vector<uint32_t> m_reverseSources;
+	std::vector<uint32_t> m_reverseEdges;
+	std::vector<uint32_t> m_nameOffsets;
+	std::string m_names;
+	std::vector<uint32_t> m_nodeIndex;
+
+	void buildIndex(); // Fills m_nodeIndex from the node text
+	void buildReverse(); // Fills the reverse adjacency from the forward one
+	void buildGeometry(); // Fills m_nodePoints and m_edgeBearings from the coordinates
+};
+
+#endif
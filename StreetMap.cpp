@@ -1,14 +1,27 @@
 #include "provided.h"
 #include "ExpandableHashMap.h"
+#include "ConnectedComponents.h"
+#include "ContractionHierarchy.h"
+#include "Landmarks.h"
+#include "MapFile.h"
+#include "SpatialIndex.h"
+#include "StreetGraph.h"
 #include <string>
 #include <vector>
 #include <functional>
+#include <atomic>
 #include <fstream>
+#include <memory>
+#include <mutex>
 using namespace std;
 
+namespace {
+	atomic<unsigned int> g_mapGenerations(0); // Loads of any StreetMap so far
+}
+
 unsigned int hasher(const GeoCoord& g)
 {
-	return std::hash<string>()(g.latitudeText + g.longitudeText);
+	return fixedCoordHash(FixedCoord::fromDegrees(g.latitude, g.longitude));
 }
 
 unsigned int hasher(const string& s) {
@@ -22,13 +35,38 @@ public:
 	~StreetMapImpl();
 	bool load(string mapFile);
 	bool getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const;
+	int nodeCount() const;
+	bool getNodeId(const GeoCoord& gc, NodeId& id) const;
+	GeoCoord getCoord(NodeId id) const;
+	bool snapToNetwork(double latitude, double longitude, NetworkSnap& snap) const;
+	string getStreetName(unsigned int nameId) const;
+	bool getEdgesThatStartWith(NodeId id, vector<StreetEdge>& edges) const;
+	StreetEdgeRange getEdgesFrom(NodeId id) const;
+	const StreetGraph& graph() const { return m_graph; }
+	const ConnectedComponents& components() const;
+	const ContractionHierarchy& contractionHierarchy() const;
+	const Landmarks& landmarks() const;
+	const SpatialIndex& spatialIndex() const;
+	unsigned int generation() const { return m_generation; }
+	static bool compile(string mapFile, string binaryFile);
+	static bool verify(string binaryFile);
 private:
-	ExpandableHashMap<GeoCoord, vector<StreetSegment>> m_streetMap; // Stores all mapdata
-	StreetSegment reverse(const StreetSegment& segment); // Reverse the GeoCoords on a StreetSegment
+	StreetGraphData m_data; // Owns the tables when the map was parsed from text
+	MappedMapFile m_mapFile; // Owns the tables when a binary map file is loaded
+	StreetGraph m_graph; // Stores all mapdata, pointing into m_data or m_mapFile
+	unsigned int m_generation; // Changed by every load, even one that fails
+
+	// Preprocessing built from m_graph on first use; the mutex lets routers on several threads ask at once
+	mutable mutex m_preprocessingMutex;
+	mutable unique_ptr<ConnectedComponents> m_components;
+	mutable unique_ptr<ContractionHierarchy> m_hierarchy;
+	mutable unique_ptr<Landmarks> m_landmarks;
+	mutable unique_ptr<SpatialIndex> m_spatialIndex; // R-tree of m_graph's segments
 };
 
 StreetMapImpl::StreetMapImpl()
 {
+	m_generation = 0;
 }
 
 StreetMapImpl::~StreetMapImpl()
@@ -37,106 +75,153 @@ StreetMapImpl::~StreetMapImpl()
 
 bool StreetMapImpl::load(string mapFile)
 {
-	// Attach the file to extract data
-	ifstream inFile;
-	inFile.open(mapFile);
-	if (!inFile) {
-		cerr << "Unable to open file " << mapFile << endl;
-		return false;
-	}
-	// Retrieves the street name
-	for (string street; getline(inFile, street);) {
-		// Retrieves the number of GeoCoords the street contains
-		string num;
-		getline(inFile, num);
-		// Converts num to an integer
-		int numCoords = stoi(num);
-
-		StreetSegment reversedSeg;
-		// For each GeoCoord
-		for (int i = 0; i < numCoords; i++) {
-			int j = 0; // Index for the vector
-			vector<StreetSegment> v(2);
-			// Adds the previous segment reversed, if the current
-			// GeoCoord isn't the first or last in the StreetSegment
-			if (i != 0) {
-				v[j] = reversedSeg;
-				j++;
-			}
-
-			// Retrieves the first GeoCoord
-			string startLat;
-			inFile >> startLat;
-			string startLong;
-			inFile >> startLong;
-			GeoCoord start(startLat, startLong);
-			
-			// Retrieves the second GeoCoord
-			string endLat;
-			inFile >> endLat;
-			string endLong;
-			inFile >> endLong;
-			GeoCoord end(endLat, endLong);
-
-			// Creates the StreetSegment
-			StreetSegment seg(start, end, street);
-			v[j] = seg;
-
-			// Resizes the array if its the first StreetSegment of the street
-			if (i == 0)
-				v.resize(1);
-			reversedSeg = reverse(seg); // Reverses the current StreetSegment and stores it
-
-			// Check if the key-value pair already exists
-			vector<StreetSegment>* s = m_streetMap.find(start);
-			// If it does, add to the end of the existing vector
-			if (s != nullptr)
-				for (int i = 0; i < v.size(); i++)
-					s->push_back(v[i]);
-			// If not, add a new key-value pair
-			else
-				m_streetMap.associate(start, v);
-		}
+	m_generation = ++g_mapGenerations;
+	m_components.reset();
+	m_hierarchy.reset();
+	m_landmarks.reset();
+	m_spatialIndex.reset();
+	m_graph = StreetGraph();
+	m_mapFile.close();
 
-		// Adds the last StreetSegment of the road, if it's longer than 1
-		if (numCoords > 1) {
-			vector<StreetSegment> v(1);
-			v[0] = (reversedSeg);
-			
-			vector<StreetSegment>* s = m_streetMap.find(reversedSeg.start);
-			if (s != nullptr)
-				for (int i = 0; i < v.size(); i++)
-					s->push_back(v[i]);
-			else
-				m_streetMap.associate(reversedSeg.start, v);
+	// Binary map files are mapped and queried in place instead of parsed
+	if (isMapFile(mapFile)) {
+		if (!m_mapFile.open(mapFile)) {
+			cerr << "Unable to map file " << mapFile << endl;
+			return false;
 		}
-
-		// Discards the newline character
-		getline(inFile, street);
+		m_graph = m_mapFile.graph();
+		return true;
 	}
 
-	inFile.close();
+	// Parses the text into dense node ids and CSR adjacency
+	if (!m_data.parse(mapFile)) {
+		cerr << "Unable to open file " << mapFile << endl;
+		return false;
+	}
+	m_graph = m_data.view();
 	return true;
 }
 
 bool StreetMapImpl::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const
 {
-	// Finds the key-value pair for gc
-	const vector<StreetSegment>* segVector = m_streetMap.find(gc);
+	// If gc isn't a node, return false
+	// If it is, build a StreetSegment for each of its edges and return true
+	NodeId id;
+	if (!m_graph.findNode(gc, id))
+		return false;
+	segs.clear();
+	GeoCoord start = m_graph.coord(id);
+	for (uint32_t e = m_graph.edgeOffsets[id]; e < m_graph.edgeOffsets[id + 1]; e++)
+		segs.push_back(StreetSegment(start, m_graph.coord(m_graph.edgeTargets[e]), m_graph.name(m_graph.edgeNames[e])));
+	return true;
+}
+
+int StreetMapImpl::nodeCount() const
+{
+	return m_graph.numNodes;
+}
+
+bool StreetMapImpl::getNodeId(const GeoCoord& gc, NodeId& id) const
+{
+	return m_graph.findNode(gc, id);
+}
+
+GeoCoord StreetMapImpl::getCoord(NodeId id) const
+{
+	return m_graph.coord(id);
+}
+
+bool StreetMapImpl::snapToNetwork(double latitude, double longitude, NetworkSnap& snap) const
+{
+	return spatialIndex().snap(latitude, longitude, snap);
+}
+
+string StreetMapImpl::getStreetName(unsigned int nameId) const
+{
+	return m_graph.name(nameId);
+}
 
-	// If it doesn't exist, return false
-	// If it does, retreive the value and return true
-	if (segVector == nullptr)
+bool StreetMapImpl::getEdgesThatStartWith(NodeId id, vector<StreetEdge>& edges) const
+{
+	if (id >= m_graph.numNodes)
 		return false;
-	segs = *segVector;
+	edges.clear();
+	for (uint32_t e = m_graph.edgeOffsets[id]; e < m_graph.edgeOffsets[id + 1]; e++) {
+		StreetEdge edge;
+		edge.target = m_graph.edgeTargets[e];
+		edge.nameId = m_graph.edgeNames[e];
+		edge.length = m_graph.edgeLengths[e];
+		edges.push_back(edge);
+	}
 	return true;
 }
 
-StreetSegment StreetMapImpl::reverse(const StreetSegment& segment)
+StreetEdgeRange StreetMapImpl::getEdgesFrom(NodeId id) const
+{
+	// Unknown ids get an empty range
+	if (id >= m_graph.numNodes) {
+		StreetEdgeRange none = { nullptr, nullptr, nullptr, 0, 0 };
+		return none;
+	}
+	return m_graph.edges(id);
+}
+
+const ConnectedComponents& StreetMapImpl::components() const
+{
+	lock_guard<mutex> lock(m_preprocessingMutex);
+	if (!m_components) {
+		m_components.reset(new ConnectedComponents);
+		m_components->build(m_graph);
+	}
+	return *m_components;
+}
+
+const ContractionHierarchy& StreetMapImpl::contractionHierarchy() const
+{
+	lock_guard<mutex> lock(m_preprocessingMutex);
+	if (!m_hierarchy) {
+		m_hierarchy.reset(new ContractionHierarchy);
+		m_hierarchy->build(m_graph);
+	}
+	return *m_hierarchy;
+}
+
+const Landmarks& StreetMapImpl::landmarks() const
+{
+	lock_guard<mutex> lock(m_preprocessingMutex);
+	if (!m_landmarks) {
+		m_landmarks.reset(new Landmarks);
+		m_landmarks->build(m_graph);
+	}
+	return *m_landmarks;
+}
+
+const SpatialIndex& StreetMapImpl::spatialIndex() const
+{
+	lock_guard<mutex> lock(m_preprocessingMutex);
+	if (!m_spatialIndex) {
+		m_spatialIndex.reset(new SpatialIndex);
+		m_spatialIndex->build(m_graph);
+	}
+	return *m_spatialIndex;
+}
+
+bool StreetMapImpl::compile(string mapFile, string binaryFile)
+{
+	// Parses the text into flat tables and writes them out as they are, then reads them
+	// back the way load() would if it checked everything
+	StreetGraphData data;
+	if (!data.parse(mapFile)) {
+		cerr << "Unable to open file " << mapFile << endl;
+		return false;
+	}
+	return writeMapFile(data.view(), binaryFile) && verify(binaryFile);
+}
+
+bool StreetMapImpl::verify(string binaryFile)
 {
-	// Reverse segment
-	StreetSegment reversed(segment.end, segment.start, segment.name);
-	return reversed;
+	MappedMapFile mapFile;
+	return mapFile.open(binaryFile, true);
 }
 
 //******************** StreetMap functions ************************************
@@ -163,3 +248,75 @@ bool StreetMap::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegmen
 {
 	return m_impl->getSegmentsThatStartWith(gc, segs);
 }
+
+int StreetMap::nodeCount() const
+{
+	return m_impl->nodeCount();
+}
+
+bool StreetMap::getNodeId(const GeoCoord& gc, NodeId& id) const
+{
+	return m_impl->getNodeId(gc, id);
+}
+
+GeoCoord StreetMap::getCoord(NodeId id) const
+{
+	return m_impl->getCoord(id);
+}
+
+bool StreetMap::snapToNetwork(double latitude, double longitude, NetworkSnap& snap) const
+{
+	return m_impl->snapToNetwork(latitude, longitude, snap);
+}
+
+string StreetMap::getStreetName(unsigned int nameId) const
+{
+	return m_impl->getStreetName(nameId);
+}
+
+bool StreetMap::getEdgesThatStartWith(NodeId id, vector<StreetEdge>& edges) const
+{
+	return m_impl->getEdgesThatStartWith(id, edges);
+}
+
+StreetEdgeRange StreetMap::getEdgesFrom(NodeId id) const
+{
+	return m_impl->getEdgesFrom(id);
+}
+
+bool StreetMap::compile(string mapFile, string binaryFile)
+{
+	return StreetMapImpl::compile(mapFile, binaryFile);
+}
+
+bool StreetMap::verify(string binaryFile)
+{
+	return StreetMapImpl::verify(binaryFile);
+}
+
+//******************** StreetMapInternals functions ***************************
+
+const StreetGraph& StreetMapInternals::graph(const StreetMap& sm)
+{
+	return sm.m_impl->graph();
+}
+
+const ConnectedComponents& StreetMapInternals::components(const StreetMap& sm)
+{
+	return sm.m_impl->components();
+}
+
+const ContractionHierarchy& StreetMapInternals::contractionHierarchy(const StreetMap& sm)
+{
+	return sm.m_impl->contractionHierarchy();
+}
+
+const Landmarks& StreetMapInternals::landmarks(const StreetMap& sm)
+{
+	return sm.m_impl->landmarks();
+}
+
+unsigned int StreetMapInternals::generation(const StreetMap& sm)
+{
+	return sm.m_impl->generation();
+}
@@ -0,0 +1,82 @@
+#include "ThreadPool.h"
+#include <algorithm>
+using namespace std;
+
+ThreadPool::ThreadPool(int numWorkers)
+	: m_body(nullptr), m_count(0), m_next(0), m_busyWorkers(0), m_job(0), m_stopping(false)
+{
+	for (int i = 0; i < numWorkers; i++)
+		m_workers.push_back(thread(&ThreadPool::work, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_wake.notify_all();
+	for (size_t i = 0; i < m_workers.size(); i++)
+		m_workers[i].join();
+}
+
+void ThreadPool::parallelFor(int count, const function<void(int)>& body)
+{
+	// Not worth waking anyone for
+	if (count <= 1 || m_workers.empty()) {
+		for (int i = 0; i < count; i++)
+			body(i);
+		return;
+	}
+
+	lock_guard<mutex> job(m_jobMutex);
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_body = &body;
+		m_count = count;
+		m_next = 0;
+		m_busyWorkers = (int)m_workers.size();
+		m_job++;
+	}
+	m_wake.notify_all();
+	runJob(body, count);
+
+	// Every worker checks in, even one that found nothing left, so none can still be
+	// looking at body once this returns
+	unique_lock<mutex> lock(m_mutex);
+	m_done.wait(lock, [this] { return m_busyWorkers == 0; });
+	m_body = nullptr;
+}
+
+void ThreadPool::work()
+{
+	uint64_t lastJob = 0;
+	for (;;) {
+		unique_lock<mutex> lock(m_mutex);
+		m_wake.wait(lock, [&] { return m_stopping || m_job != lastJob; });
+		if (m_stopping)
+			return;
+		lastJob = m_job;
+		const function<void(int)>& body = *m_body;
+		int count = m_count;
+		lock.unlock();
+
+		runJob(body, count);
+
+		lock.lock();
+		if (--m_busyWorkers == 0)
+			m_done.notify_one();
+	}
+}
+
+void ThreadPool::runJob(const function<void(int)>& body, int count)
+{
+	for (int i = m_next.fetch_add(1); i < count; i = m_next.fetch_add(1))
+		body(i);
+}
+
+ThreadPool& sharedThreadPool()
+{
+	static ThreadPool pool(max(1u, thread::hardware_concurrency()) - 1);
+	return pool;
+}
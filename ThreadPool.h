@@ -0,0 +1,55 @@
+// ThreadPool.h
+
+// A fixed set of worker threads for splitting independent work, such as one route search
+// per source point, across cores.  Work is handed out one index at a time, so long and
+// short items balance out.
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int numWorkers);
+	~ThreadPool();
+
+	// Threads that run work, counting the one that calls parallelFor
+	int numThreads() const { return (int)m_workers.size() + 1; }
+
+	// Calls body(i) for every i from 0 to count - 1 on the workers and the calling thread,
+	// returning once all calls have finished.  Calls from several threads take turns; body
+	// must not call parallelFor on the same pool.
+	void parallelFor(int count, const std::function<void(int)>& body);
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+private:
+	std::vector<std::thread> m_workers;
+	std::mutex m_jobMutex; // Held by the thread whose job is running
+
+	// The current job, guarded by m_mutex except for m_next
+	std::mutex m_mutex;
+	std::condition_variable m_wake; // Signals workers that a job was posted or the pool is stopping
+	std::condition_variable m_done; // Signals the caller that every worker finished the job
+	const std::function<void(int)>* m_body;
+	int m_count;
+	std::atomic<int> m_next; // Next index to hand out
+	int m_busyWorkers; // Workers that haven't finished the current job
+	uint64_t m_job; // Counts jobs posted, so workers can tell a new one has come
+	bool m_stopping;
+
+	void work();
+	void runJob(const std::function<void(int)>& body, int count);
+};
+
+// A pool shared by the whole program, with one thread per core
+ThreadPool& sharedThreadPool();
+
+#endif
@@ -29,12 +29,46 @@ using namespace std;
 
 bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v);
 bool parseDelivery(string line, string& lat, string& lon, string& item);
+int runBenchmarks(string mapFile);
+int runStressTests(string mapFile);
 
 int main(int argc, char* argv[])
 {
+	if (argc == 4 && string(argv[1]) == "--compile")
+	{
+		if (!StreetMap::compile(argv[2], argv[3]))
+		{
+			cout << "Unable to compile map data file " << argv[2] << endl;
+			return 1;
+		}
+		cout << "Compiled " << argv[2] << " into " << argv[3] << endl;
+		return 0;
+	}
+
+	if (argc == 3 && string(argv[1]) == "--verify")
+	{
+		if (!StreetMap::verify(argv[2]))
+		{
+			cout << "Map file " << argv[2] << " failed verification" << endl;
+			return 1;
+		}
+		cout << "Verified " << argv[2] << endl;
+		return 0;
+	}
+
+	if (argc == 3 && string(argv[1]) == "--bench")
+		return runBenchmarks(argv[2]);
+
+	if (argc == 3 && string(argv[1]) == "--stress")
+		return runStressTests(argv[2]);
+
 	if (argc != 3)
 	{
 		cout << "Usage: " << argv[0] << " mapdata.txt deliveries.txt" << endl;
+		cout << "       " << argv[0] << " --compile mapdata.txt mapdata.bin" << endl;
+		cout << "       " << argv[0] << " --verify mapdata.bin" << endl;
+		cout << "       " << argv[0] << " --bench mapdata.txt" << endl;
+		cout << "       " << argv[0] << " --stress mapdata.txt" << endl;
 		return 1;
 	}
 
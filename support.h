@@ -1,15 +1,42 @@
+#ifndef SUPPORT_H
+#define SUPPORT_H
+
 #include "provided.h"
-#include "ExpandableHashMap.h"
-
-// Comparator for the priority_queue utilized in a_star
-struct CompareCoord {
-	CompareCoord(ExpandableHashMap<GeoCoord, double>* m) {
-		f_N = m;
-	}
-	// Prioritizes smaller fScore values
-	bool operator() (const GeoCoord& g1, const GeoCoord& g2) {
-		return *f_N->find(g1) > * f_N->find(g2);
-	}
-
-	ExpandableHashMap<GeoCoord, double>* f_N; // Map of fScore values
-};
\ No newline at end of file
+#include <cmath>
+
+// Distance between two points given in degrees, the same as distanceEarthMiles
+// but without needing GeoCoords
+inline double distanceEarthMiles(double lat1d, double lon1d, double lat2d, double lon2d) {
+	static const double earthRadiusKm = 6371.0;
+	const double milesPerKm = 1 / 1.609344;
+	double lat1r = deg2rad(lat1d);
+	double lon1r = deg2rad(lon1d);
+	double lat2r = deg2rad(lat2d);
+	double lon2r = deg2rad(lon2d);
+	double u = std::sin((lat2r - lat1r) / 2);
+	double v = std::sin((lon2r - lon1r) / 2);
+	return 2.0 * earthRadiusKm * std::asin(std::sqrt(u * u + std::cos(lat1r) * std::cos(lat2r) * v * v)) * milesPerKm;
+}
+
+// The same as angleOfLine, for a segment whose direction is already known as a bearing
+// (see StreetGraph::edgeBearings)
+inline double angleOfBearing(double bearing)
+{
+	double result = rad2deg(bearing);
+	if (result < 0)
+		result += 360;
+
+	return result;
+}
+
+// The same as angleBetween2Lines, for segments whose bearings are already known
+inline double angleBetweenBearings(double bearing1, double bearing2)
+{
+	double result = rad2deg(bearing2 - bearing1);
+	if (result < 0)
+		result += 360;
+
+	return result;
+}
+
+#endif